@@ -0,0 +1,122 @@
+// Counts heap allocations and time per query on a random index.
+// Build from search-server: g++ -std=c++17 -O2 -pthread -I. benchmark/query_allocations.cpp $(ls *.cpp | grep -v main.cpp) -ltbb
+#include "search_server.h"
+#include "log_duration.h"
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std::literals::string_literals;
+
+namespace
+{
+    std::atomic<size_t> allocation_count = 0;
+
+    std::string GenerateWord(std::mt19937 &generator, size_t max_length)
+    {
+        const size_t length = 1 + generator() % max_length;
+        std::string word(length, ' ');
+        for (char &c : word)
+        {
+            c = static_cast<char>('a' + generator() % 26);
+        }
+        return word;
+    }
+
+    std::vector<std::string> GenerateDictionary(std::mt19937 &generator, size_t word_count, size_t max_length)
+    {
+        std::vector<std::string> words;
+        for (size_t i = 0; i < word_count; ++i)
+        {
+            words.push_back(GenerateWord(generator, max_length));
+        }
+        return words;
+    }
+
+    std::string GenerateText(std::mt19937 &generator, const std::vector<std::string> &dictionary, size_t word_count,
+                             double minus_probability = 0.0)
+    {
+        std::string text;
+        for (size_t i = 0; i < word_count; ++i)
+        {
+            if (!text.empty())
+            {
+                text += ' ';
+            }
+            if (std::uniform_real_distribution<>(0.0, 1.0)(generator) < minus_probability)
+            {
+                text += '-';
+            }
+            text += dictionary[generator() % dictionary.size()];
+        }
+        return text;
+    }
+
+    template <typename Func>
+    void Measure(const std::string &name, const std::vector<std::string> &queries, Func func)
+    {
+        const size_t allocations_before = allocation_count;
+        {
+            LOG_DURATION(name);
+            for (const std::string &query : queries)
+            {
+                func(query);
+            }
+        }
+        std::cout << name << ": "s << static_cast<double>(allocation_count - allocations_before) / queries.size()
+                  << " allocations per query"s << std::endl;
+    }
+}
+
+void *operator new(size_t size)
+{
+    ++allocation_count;
+    if (void *pointer = std::malloc(size == 0 ? 1 : size))
+    {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    std::free(pointer);
+}
+
+int main()
+{
+    std::mt19937 generator(7);
+    const auto dictionary = GenerateDictionary(generator, 10000, 25);
+    const auto queries = [&generator, &dictionary]
+    {
+        std::vector<std::string> queries;
+        for (int i = 0; i < 10000; ++i)
+        {
+            queries.push_back(GenerateText(generator, dictionary, 7, 0.1));
+        }
+        return queries;
+    }();
+
+    SearchServer search_server(dictionary[0]);
+    for (int id = 0; id < 20000; ++id)
+    {
+        search_server.AddDocument(id, GenerateText(generator, dictionary, 70), DocumentStatus::ACTUAL, {1, 2, 3});
+    }
+    search_server.WaitForMerges();
+
+    size_t result_count = 0;
+    Measure("FindTopDocuments"s, queries, [&search_server, &result_count](const std::string &query)
+            { result_count += search_server.FindTopDocuments(query).size(); });
+    Measure("MatchDocument"s, queries, [&search_server, &result_count](const std::string &query)
+            { result_count += std::get<0>(search_server.MatchDocument(query, static_cast<int>(query.size()))).size(); });
+    std::cout << result_count << std::endl;
+    return 0;
+}
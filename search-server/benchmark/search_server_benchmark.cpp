@@ -0,0 +1,379 @@
+// Google Benchmark suite for the indexing and query paths on reproducible synthetic corpora.
+// Build from search-server:
+//   g++ -std=c++17 -O2 -pthread -I. benchmark/search_server_benchmark.cpp $(ls *.cpp | grep -v main.cpp) -lbenchmark -ltbb
+// Results are printed as JSON unless another --benchmark_format is given; to keep them for comparing releases,
+// add --benchmark_out=results.json and compare two files with tools/compare.py from Google Benchmark
+#include "search_server.h"
+#include "process_queries.h"
+#include "remove_duplicates.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+using namespace std::literals::string_literals;
+
+namespace
+{
+    struct CorpusOptions
+    {
+        size_t document_count = 10000;
+        // Words per document
+        size_t document_length = 50;
+        size_t vocabulary_size = 20000;
+        // Word of rank r occurs with probability proportional to 1 / r^zipf_exponent
+        double zipf_exponent = 1.0;
+        uint64_t seed = 42;
+    };
+
+    // Documents and queries drawn from a Zipfian vocabulary of random words. The generator only uses raw
+    // std::mt19937_64 output, whose sequence the standard fixes, so a seed gives the same corpus everywhere
+    class SyntheticCorpus
+    {
+    public:
+        explicit SyntheticCorpus(const CorpusOptions &options)
+            : generator_(options.seed)
+        {
+            vocabulary_.reserve(options.vocabulary_size);
+            for (size_t i = 0; i < options.vocabulary_size; ++i)
+            {
+                vocabulary_.push_back(GenerateWord());
+            }
+            double weight_sum = 0.0;
+            for (size_t rank = 1; rank <= options.vocabulary_size; ++rank)
+            {
+                weight_sum += 1.0 / std::pow(static_cast<double>(rank), options.zipf_exponent);
+                cumulative_weights_.push_back(weight_sum);
+            }
+            documents_.reserve(options.document_count);
+            for (size_t i = 0; i < options.document_count; ++i)
+            {
+                documents_.push_back(GenerateText(options.document_length, 0.0));
+            }
+        }
+
+        const std::vector<std::string> &GetDocuments() const
+        {
+            return documents_;
+        }
+
+        std::vector<std::string> GenerateQueries(size_t query_count, size_t query_length, double minus_probability)
+        {
+            std::vector<std::string> queries;
+            queries.reserve(query_count);
+            for (size_t i = 0; i < query_count; ++i)
+            {
+                queries.push_back(GenerateText(query_length, minus_probability));
+            }
+            return queries;
+        }
+
+    private:
+        std::mt19937_64 generator_;
+        std::vector<std::string> vocabulary_;
+        std::vector<double> cumulative_weights_;
+        std::vector<std::string> documents_;
+
+        double GenerateUnit()
+        {
+            return static_cast<double>(generator_() >> 11) * 0x1.0p-53;
+        }
+
+        std::string GenerateWord()
+        {
+            const size_t length = 3 + generator_() % 8;
+            std::string word(length, ' ');
+            for (char &c : word)
+            {
+                c = static_cast<char>('a' + generator_() % 26);
+            }
+            return word;
+        }
+
+        const std::string &GenerateZipfWord()
+        {
+            const double target = GenerateUnit() * cumulative_weights_.back();
+            const auto rank = std::upper_bound(cumulative_weights_.begin(), cumulative_weights_.end(), target) -
+                              cumulative_weights_.begin();
+            return vocabulary_[std::min<size_t>(rank, vocabulary_.size() - 1)];
+        }
+
+        std::string GenerateText(size_t word_count, double minus_probability)
+        {
+            std::string text;
+            for (size_t i = 0; i < word_count; ++i)
+            {
+                if (!text.empty())
+                {
+                    text += ' ';
+                }
+                if (GenerateUnit() < minus_probability)
+                {
+                    text += '-';
+                }
+                text += GenerateZipfWord();
+            }
+            return text;
+        }
+    };
+
+    const size_t QUERY_COUNT = 1000;
+    const size_t QUERY_LENGTH = 5;
+    const double QUERY_MINUS_PROBABILITY = 0.1;
+
+    CorpusOptions MakeCorpusOptions(const benchmark::State &state)
+    {
+        CorpusOptions options;
+        options.document_count = static_cast<size_t>(state.range(0));
+        options.document_length = static_cast<size_t>(state.range(1));
+        return options;
+    }
+
+    // Corpora and queries are shared by the benchmarks that use the same arguments
+    SyntheticCorpus &GetCorpus(const CorpusOptions &options)
+    {
+        static std::map<std::tuple<size_t, size_t>, std::unique_ptr<SyntheticCorpus>> corpora;
+        auto &corpus = corpora[{options.document_count, options.document_length}];
+        if (!corpus)
+        {
+            corpus = std::make_unique<SyntheticCorpus>(options);
+        }
+        return *corpus;
+    }
+
+    const std::vector<std::string> &GetQueries(const CorpusOptions &options)
+    {
+        static std::map<std::tuple<size_t, size_t>, std::vector<std::string>> query_sets;
+        auto &queries = query_sets[{options.document_count, options.document_length}];
+        if (queries.empty())
+        {
+            queries = GetCorpus(options).GenerateQueries(QUERY_COUNT, QUERY_LENGTH, QUERY_MINUS_PROBABILITY);
+        }
+        return queries;
+    }
+
+    std::unique_ptr<SearchServer> BuildServer(const std::vector<std::string> &documents)
+    {
+        auto search_server = std::make_unique<SearchServer>("and in on the"s);
+        for (size_t id = 0; id < documents.size(); ++id)
+        {
+            search_server->AddDocument(static_cast<int>(id), documents[id], DocumentStatus::ACTUAL, {1, 2, 3});
+        }
+        search_server->WaitForMerges();
+        return search_server;
+    }
+
+    // Query benchmarks do not change the server, so it is built once per corpus
+    const SearchServer &GetServer(const CorpusOptions &options)
+    {
+        static std::map<std::tuple<size_t, size_t>, std::unique_ptr<SearchServer>> servers;
+        auto &search_server = servers[{options.document_count, options.document_length}];
+        if (!search_server)
+        {
+            search_server = BuildServer(GetCorpus(options).GetDocuments());
+        }
+        return *search_server;
+    }
+
+    void CorpusArguments(benchmark::internal::Benchmark *benchmark)
+    {
+        benchmark->ArgNames({"documents", "length"});
+        for (const int64_t document_count : {1000, 10000, 50000})
+        {
+            benchmark->Args({document_count, 50});
+        }
+        benchmark->Args({10000, 200});
+    }
+}
+
+static void BM_AddDocument(benchmark::State &state)
+{
+    const auto &documents = GetCorpus(MakeCorpusOptions(state)).GetDocuments();
+    for (auto _ : state)
+    {
+        // Includes the background merges, which are part of the cost of indexing
+        auto search_server = BuildServer(documents);
+        benchmark::DoNotOptimize(search_server->GetDocumentCount());
+        state.PauseTiming();
+        search_server.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(documents.size()));
+}
+BENCHMARK(BM_AddDocument)->Apply(CorpusArguments)->Unit(benchmark::kMillisecond);
+
+static void BM_FindTopDocuments(benchmark::State &state)
+{
+    const CorpusOptions options = MakeCorpusOptions(state);
+    const SearchServer &search_server = GetServer(options);
+    const auto &queries = GetQueries(options);
+    size_t query = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(search_server.FindTopDocuments(queries[query++ % queries.size()]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FindTopDocuments)->Apply(CorpusArguments);
+
+static void BM_FindTopDocumentsPredicate(benchmark::State &state)
+{
+    const CorpusOptions options = MakeCorpusOptions(state);
+    const SearchServer &search_server = GetServer(options);
+    const auto &queries = GetQueries(options);
+    size_t query = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(search_server.FindTopDocuments(
+            queries[query++ % queries.size()], [](int document_id, DocumentStatus, int)
+            { return document_id % 2 == 0; }));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FindTopDocumentsPredicate)->Apply(CorpusArguments);
+
+static void BM_FindTopDocumentsParallel(benchmark::State &state)
+{
+    const CorpusOptions options = MakeCorpusOptions(state);
+    const SearchServer &search_server = GetServer(options);
+    const auto &queries = GetQueries(options);
+    size_t query = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(search_server.FindTopDocuments(std::execution::par, queries[query++ % queries.size()]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FindTopDocumentsParallel)->Apply(CorpusArguments);
+
+static void BM_MatchDocument(benchmark::State &state)
+{
+    const CorpusOptions options = MakeCorpusOptions(state);
+    const SearchServer &search_server = GetServer(options);
+    const auto &queries = GetQueries(options);
+    size_t query = 0;
+    for (auto _ : state)
+    {
+        const int document_id = static_cast<int>(query % options.document_count);
+        benchmark::DoNotOptimize(search_server.MatchDocument(queries[query++ % queries.size()], document_id));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MatchDocument)->Apply(CorpusArguments);
+
+static void BM_RemoveDocument(benchmark::State &state)
+{
+    const auto &documents = GetCorpus(MakeCorpusOptions(state)).GetDocuments();
+    // Every tenth document is removed, one call each
+    const size_t removed_count = documents.size() / 10;
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        auto search_server = BuildServer(documents);
+        state.ResumeTiming();
+        for (size_t i = 0; i < removed_count; ++i)
+        {
+            search_server->RemoveDocument(static_cast<int>(i * 10));
+        }
+        state.PauseTiming();
+        search_server.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(removed_count));
+}
+BENCHMARK(BM_RemoveDocument)->Apply(CorpusArguments)->Unit(benchmark::kMillisecond);
+
+static void BM_RemoveDuplicates(benchmark::State &state)
+{
+    // Every fifth document repeats the words of the previous one in another order
+    std::vector<std::string> documents = GetCorpus(MakeCorpusOptions(state)).GetDocuments();
+    for (size_t id = 5; id < documents.size(); id += 5)
+    {
+        std::istringstream words(documents[id - 1]);
+        std::string text;
+        for (std::string word; words >> word;)
+        {
+            text = word + ' ' + text;
+        }
+        documents[id] = text;
+    }
+    // RemoveDuplicates prints the removed ids, which must not mix with the results
+    std::ostringstream removed_ids;
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        auto search_server = BuildServer(documents);
+        removed_ids.str({});
+        std::streambuf *const output = std::cout.rdbuf(removed_ids.rdbuf());
+        state.ResumeTiming();
+        RemoveDuplicates(*search_server);
+        state.PauseTiming();
+        std::cout.rdbuf(output);
+        search_server.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(documents.size()));
+}
+BENCHMARK(BM_RemoveDuplicates)->Apply(CorpusArguments)->Unit(benchmark::kMillisecond);
+
+static void BM_ProcessQueries(benchmark::State &state)
+{
+    const CorpusOptions options = MakeCorpusOptions(state);
+    const SearchServer &search_server = GetServer(options);
+    const auto &queries = GetQueries(options);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(ProcessQueries(search_server, queries));
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(queries.size()));
+}
+BENCHMARK(BM_ProcessQueries)->Apply(CorpusArguments)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_ProcessQueriesJoined(benchmark::State &state)
+{
+    const CorpusOptions options = MakeCorpusOptions(state);
+    const SearchServer &search_server = GetServer(options);
+    const auto &queries = GetQueries(options);
+    for (auto _ : state)
+    {
+        size_t document_count = 0;
+        for (const Document &document : ProcessQueriesJoined(search_server, queries))
+        {
+            benchmark::DoNotOptimize(document);
+            ++document_count;
+        }
+        benchmark::DoNotOptimize(document_count);
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(queries.size()));
+}
+BENCHMARK(BM_ProcessQueriesJoined)->Apply(CorpusArguments)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+int main(int argc, char **argv)
+{
+    // JSON is the default output, so that runs of different releases can be compared
+    std::vector<char *> arguments(argv, argv + argc);
+    std::string json_format = "--benchmark_format=json"s;
+    const bool has_format = std::any_of(arguments.begin(), arguments.end(), [](const char *argument)
+                                        { return std::string_view(argument).substr(0, 19) == "--benchmark_format="; });
+    if (!has_format)
+    {
+        arguments.insert(arguments.begin() + 1, json_format.data());
+    }
+    int argument_count = static_cast<int>(arguments.size());
+    benchmark::Initialize(&argument_count, arguments.data());
+    if (benchmark::ReportUnrecognizedArguments(argument_count, arguments.data()))
+    {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
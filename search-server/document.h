@@ -1,6 +1,7 @@
 #pragma once
 #include <iostream>
 
+const double ACCURACY = 1e-6;
 
 enum class DocumentStatus {
     ACTUAL,
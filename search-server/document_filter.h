@@ -0,0 +1,22 @@
+#pragma once
+#include "document.h"
+#include <optional>
+
+// Number of DocumentStatus values
+const size_t DOCUMENT_STATUS_COUNT = 4;
+
+// Declarative condition on document attributes. Unlike an arbitrary predicate, searches evaluate it on
+// the status bitmaps and rating column of the index and skip postings of documents that do not pass
+// before scoring them. It can also be called like a predicate
+struct DocumentFilter
+{
+    // Any status if empty
+    std::optional<DocumentStatus> status;
+    // Any rating if empty
+    std::optional<int> min_rating;
+
+    bool operator()(int, DocumentStatus document_status, int rating) const
+    {
+        return (!status || document_status == *status) && (!min_rating || rating >= *min_rating);
+    }
+};
@@ -0,0 +1,423 @@
+#include "index_file.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std::literals::string_literals;
+
+namespace
+{
+    const char INDEX_FILE_MAGIC[8] = {'S', 'R', 'C', 'H', 'I', 'D', 'X', '\0'};
+    const uint32_t INDEX_FILE_VERSION = 4;
+    // Header flag of files that store token positions
+    const uint64_t INDEX_FILE_HAS_POSITIONS = 1;
+    const uint32_t BYTE_ORDER_MARK = 0x01020304;
+    // Every section starts at a multiple of this, so the mapped arrays are properly aligned
+    const size_t SECTION_ALIGNMENT = 8;
+
+    // Followed by the sections in this order:
+    // stop word offsets, stop word bytes, term offsets, term bytes, max term frequencies,
+    // posting offsets, posting block offsets, posting blocks, posting words,
+    // documents, document ordinals, forward offsets, forward terms, forward counts
+    // and, if the file has positions, position offsets and position bytes
+    struct IndexFileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order_mark;
+        uint64_t file_size;
+        // Of everything after the header
+        uint64_t checksum;
+        uint64_t stop_word_count;
+        uint64_t term_count;
+        uint64_t document_count;
+        uint64_t posting_count;
+        uint64_t posting_block_count;
+        uint64_t posting_word_count;
+        uint64_t flags;
+        uint64_t position_byte_count;
+    };
+
+    // FNV-1a
+    class Checksum
+    {
+    public:
+        void Update(const char *data, size_t size)
+        {
+            for (size_t i = 0; i < size; ++i)
+            {
+                value_ = (value_ ^ static_cast<unsigned char>(data[i])) * 0x100000001b3;
+            }
+        }
+
+        uint64_t GetValue() const
+        {
+            return value_;
+        }
+
+    private:
+        uint64_t value_ = 0xcbf29ce484222325;
+    };
+
+    class IndexFileWriter
+    {
+    public:
+        explicit IndexFileWriter(const std::string &path)
+            : output_(path, std::ios::binary | std::ios::trunc)
+        {
+            if (!output_)
+            {
+                throw std::runtime_error("Can not create index file "s + path);
+            }
+            const IndexFileHeader header{};
+            output_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        }
+
+        template <typename T>
+        void WriteArray(const T *data, size_t count)
+        {
+            const size_t padding = (SECTION_ALIGNMENT - size_ % SECTION_ALIGNMENT) % SECTION_ALIGNMENT;
+            const char zeros[SECTION_ALIGNMENT] = {};
+            Write(zeros, padding);
+            Write(reinterpret_cast<const char *>(data), count * sizeof(T));
+        }
+
+        // Strings are stored as offsets into the concatenation of their bytes
+        void WriteStrings(const std::vector<std::string_view> &strings)
+        {
+            std::vector<uint64_t> offsets(1, 0);
+            std::string bytes;
+            for (const std::string_view str : strings)
+            {
+                bytes += str;
+                offsets.push_back(bytes.size());
+            }
+            WriteArray(offsets.data(), offsets.size());
+            WriteArray(bytes.data(), bytes.size());
+        }
+
+        void Finish(IndexFileHeader header)
+        {
+            std::memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+            header.version = INDEX_FILE_VERSION;
+            header.byte_order_mark = BYTE_ORDER_MARK;
+            header.file_size = sizeof(header) + size_;
+            header.checksum = checksum_.GetValue();
+            output_.seekp(0);
+            output_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            output_.close();
+            if (!output_)
+            {
+                throw std::runtime_error("Can not write index file"s);
+            }
+        }
+
+    private:
+        std::ofstream output_;
+        size_t size_ = 0;
+        Checksum checksum_;
+
+        void Write(const char *data, size_t size)
+        {
+            output_.write(data, size);
+            checksum_.Update(data, size);
+            size_ += size;
+        }
+    };
+
+    class IndexFileReader
+    {
+    public:
+        IndexFileReader(const char *data, size_t size)
+            : data_(data), size_(size) {}
+
+        template <typename T>
+        const T *ReadArray(uint64_t count)
+        {
+            position_ += (SECTION_ALIGNMENT - position_ % SECTION_ALIGNMENT) % SECTION_ALIGNMENT;
+            if (position_ > size_ || count > (size_ - position_) / sizeof(T))
+            {
+                throw std::runtime_error("Index file is truncated"s);
+            }
+            const T *array = reinterpret_cast<const T *>(data_ + position_);
+            position_ += count * sizeof(T);
+            return array;
+        }
+
+        std::vector<std::string_view> ReadStrings(uint64_t count)
+        {
+            const uint64_t *offsets = ReadArray<uint64_t>(count + 1);
+            CheckOffsets(offsets, count, "string"s);
+            const char *bytes = ReadArray<char>(offsets[count]);
+            std::vector<std::string_view> strings;
+            strings.reserve(count);
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                strings.emplace_back(bytes + offsets[i], offsets[i + 1] - offsets[i]);
+            }
+            return strings;
+        }
+
+        static void CheckOffsets(const uint64_t *offsets, uint64_t count, const std::string &section)
+        {
+            if (offsets[0] != 0 || !std::is_sorted(offsets, offsets + count + 1))
+            {
+                throw std::runtime_error("Index file has invalid "s + section + " offsets"s);
+            }
+        }
+
+    private:
+        const char *data_;
+        size_t size_;
+        size_t position_ = 0;
+    };
+
+    void WriteIndexFileSections(const std::string &path, const std::set<std::string, std::less<>> &stop_words,
+                                const IndexSegment &segment)
+    {
+        const SegmentArrays &arrays = segment.GetArrays();
+        const uint64_t posting_count = arrays.posting_offsets[arrays.term_count];
+        std::vector<std::string_view> terms;
+        terms.reserve(arrays.term_count);
+        for (uint32_t term = 0; term < arrays.term_count; ++term)
+        {
+            terms.push_back(segment.GetTermWord(term));
+        }
+
+        IndexFileWriter writer(path);
+        writer.WriteStrings(std::vector<std::string_view>(stop_words.begin(), stop_words.end()));
+        writer.WriteStrings(terms);
+        writer.WriteArray(arrays.max_term_freqs, arrays.term_count);
+        writer.WriteArray(arrays.posting_offsets, arrays.term_count + 1);
+        writer.WriteArray(arrays.posting_block_offsets, arrays.term_count + 1);
+        writer.WriteArray(arrays.posting_blocks, arrays.posting_block_offsets[arrays.term_count]);
+        writer.WriteArray(arrays.posting_words, arrays.posting_word_count);
+        writer.WriteArray(arrays.documents, arrays.document_count);
+        writer.WriteArray(arrays.document_ordinals, arrays.document_count);
+        writer.WriteArray(arrays.forward_offsets, arrays.document_count + 1);
+        writer.WriteArray(arrays.forward_terms, posting_count);
+        writer.WriteArray(arrays.forward_counts, posting_count);
+        if (segment.HasPositions())
+        {
+            writer.WriteArray(arrays.position_offsets, arrays.document_count + 1);
+            writer.WriteArray(arrays.position_bytes, arrays.position_byte_count);
+        }
+        IndexFileHeader header{};
+        header.stop_word_count = stop_words.size();
+        header.term_count = arrays.term_count;
+        header.document_count = arrays.document_count;
+        header.posting_count = posting_count;
+        header.posting_block_count = arrays.posting_block_offsets[arrays.term_count];
+        header.posting_word_count = arrays.posting_word_count;
+        header.flags = segment.HasPositions() ? INDEX_FILE_HAS_POSITIONS : 0;
+        header.position_byte_count = arrays.position_byte_count;
+        writer.Finish(header);
+    }
+}
+
+MappedFile::MappedFile(const std::string &path)
+{
+    const int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+    {
+        throw std::runtime_error("Can not open "s + path);
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0)
+    {
+        close(descriptor);
+        throw std::runtime_error("Can not read the size of "s + path);
+    }
+    size_ = static_cast<size_t>(status.st_size);
+    if (size_ > 0)
+    {
+        void *data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, descriptor, 0);
+        if (data == MAP_FAILED)
+        {
+            close(descriptor);
+            throw std::runtime_error("Can not map "s + path);
+        }
+        data_ = static_cast<const char *>(data);
+    }
+    // The mapping stays valid after the descriptor is closed
+    close(descriptor);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_)
+    {
+        munmap(const_cast<char *>(data_), size_);
+    }
+}
+
+const char *MappedFile::data() const
+{
+    return data_;
+}
+
+size_t MappedFile::size() const
+{
+    return size_;
+}
+
+void WriteIndexFile(const std::string &path, const std::set<std::string, std::less<>> &stop_words, const IndexSegment &segment)
+{
+    // A unique name in the same directory, so concurrent saves to one path do not write into each other's file
+    std::string temporary_path = path + ".XXXXXX"s;
+    const int descriptor = mkstemp(temporary_path.data());
+    if (descriptor == -1)
+    {
+        throw std::runtime_error("Can not create index file "s + path);
+    }
+    // mkstemp creates the file readable by the owner only
+    fchmod(descriptor, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    close(descriptor);
+    try
+    {
+        WriteIndexFileSections(temporary_path, stop_words, segment);
+        std::filesystem::rename(temporary_path, path);
+    }
+    catch (...)
+    {
+        std::filesystem::remove(temporary_path);
+        throw;
+    }
+}
+
+IndexFile ReadIndexFile(const std::string &path)
+{
+    IndexFile file;
+    file.mapping = std::make_shared<const MappedFile>(path);
+    const MappedFile &mapping = *file.mapping;
+    IndexFileHeader header;
+    if (mapping.size() < sizeof(header))
+    {
+        throw std::runtime_error("Index file is truncated"s);
+    }
+    std::memcpy(&header, mapping.data(), sizeof(header));
+    if (std::memcmp(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        throw std::runtime_error(path + " is not an index file"s);
+    }
+    if (header.version != INDEX_FILE_VERSION || header.byte_order_mark != BYTE_ORDER_MARK)
+    {
+        throw std::runtime_error("Unsupported index file version or byte order"s);
+    }
+    if (header.file_size != mapping.size())
+    {
+        throw std::runtime_error("Index file is truncated"s);
+    }
+    Checksum checksum;
+    checksum.Update(mapping.data() + sizeof(header), mapping.size() - sizeof(header));
+    if (checksum.GetValue() != header.checksum)
+    {
+        throw std::runtime_error("Index file checksum mismatch"s);
+    }
+
+    IndexFileReader reader(mapping.data() + sizeof(header), mapping.size() - sizeof(header));
+    file.stop_words = reader.ReadStrings(header.stop_word_count);
+    file.terms = reader.ReadStrings(header.term_count);
+    SegmentArrays &arrays = file.arrays;
+    arrays.term_count = header.term_count;
+    arrays.document_count = header.document_count;
+    arrays.max_term_freqs = reader.ReadArray<double>(header.term_count);
+    arrays.posting_offsets = reader.ReadArray<uint64_t>(header.term_count + 1);
+    arrays.posting_block_offsets = reader.ReadArray<uint64_t>(header.term_count + 1);
+    arrays.posting_blocks = reader.ReadArray<PostingBlock>(header.posting_block_count);
+    arrays.posting_word_count = header.posting_word_count;
+    arrays.posting_words = reader.ReadArray<uint32_t>(header.posting_word_count);
+    arrays.documents = reader.ReadArray<DocumentData>(header.document_count);
+    arrays.document_ordinals = reader.ReadArray<DocumentIdOrdinal>(header.document_count);
+    arrays.forward_offsets = reader.ReadArray<uint64_t>(header.document_count + 1);
+    arrays.forward_terms = reader.ReadArray<uint32_t>(header.posting_count);
+    arrays.forward_counts = reader.ReadArray<uint32_t>(header.posting_count);
+    if (header.flags & ~INDEX_FILE_HAS_POSITIONS)
+    {
+        throw std::runtime_error("Index file has unknown flags"s);
+    }
+    if (header.flags & INDEX_FILE_HAS_POSITIONS)
+    {
+        arrays.position_byte_count = header.position_byte_count;
+        arrays.position_offsets = reader.ReadArray<uint64_t>(header.document_count + 1);
+        arrays.position_bytes = reader.ReadArray<uint8_t>(header.position_byte_count);
+        IndexFileReader::CheckOffsets(arrays.position_offsets, header.document_count, "position"s);
+        if (arrays.position_offsets[header.document_count] != header.position_byte_count)
+        {
+            throw std::runtime_error("Index file sections do not match"s);
+        }
+    }
+    IndexFileReader::CheckOffsets(arrays.posting_offsets, header.term_count, "posting"s);
+    IndexFileReader::CheckOffsets(arrays.posting_block_offsets, header.term_count, "posting block"s);
+    IndexFileReader::CheckOffsets(arrays.forward_offsets, header.document_count, "forward index"s);
+    if (arrays.posting_offsets[header.term_count] != header.posting_count ||
+        arrays.posting_block_offsets[header.term_count] != header.posting_block_count ||
+        arrays.forward_offsets[header.document_count] != header.posting_count)
+    {
+        throw std::runtime_error("Index file sections do not match"s);
+    }
+    // Decoding trusts the blocks, so a block must not reach past the packed words
+    for (uint64_t i = 0; i < header.posting_block_count; ++i)
+    {
+        const PostingBlock &block = arrays.posting_blocks[i];
+        const uint64_t bit_count = uint64_t{block.size} * (block.delta_bits + block.count_bits);
+        if (block.size > POSTING_BLOCK_SIZE || block.delta_bits > 32 || block.count_bits > 32 ||
+            block.offset > header.posting_word_count ||
+            (bit_count + 31) / 32 + POSTING_WORD_PADDING > header.posting_word_count - block.offset)
+        {
+            throw std::runtime_error("Index file has an invalid posting block"s);
+        }
+    }
+    // Forward terms index the term arrays
+    for (uint64_t i = 0; i < header.posting_count; ++i)
+    {
+        if (arrays.forward_terms[i] >= header.term_count)
+        {
+            throw std::runtime_error("Index file has an invalid forward index"s);
+        }
+    }
+    // FindOrdinal binary searches the ids, and the ordinals it returns index the documents
+    for (uint64_t i = 0; i < header.document_count; ++i)
+    {
+        const DocumentIdOrdinal &entry = arrays.document_ordinals[i];
+        if (entry.ordinal >= header.document_count || arrays.documents[entry.ordinal].id != entry.id ||
+            (i > 0 && arrays.document_ordinals[i - 1].id >= entry.id))
+        {
+            throw std::runtime_error("Index file has invalid document ordinals"s);
+        }
+    }
+    // Statuses index the status bitmaps of the segment
+    for (uint64_t i = 0; i < header.document_count; ++i)
+    {
+        if (static_cast<size_t>(arrays.documents[i].status) >= DOCUMENT_STATUS_COUNT)
+        {
+            throw std::runtime_error("Index file has an invalid document status"s);
+        }
+    }
+    // Decoding trusts the position lists too, so each document must hold exactly as many values as its counts say
+    if (arrays.position_offsets)
+    {
+        for (uint64_t i = 0; i < header.document_count; ++i)
+        {
+            uint64_t value_count = 0;
+            for (uint64_t entry = arrays.forward_offsets[i]; entry < arrays.forward_offsets[i + 1]; ++entry)
+            {
+                value_count += arrays.forward_counts[entry];
+            }
+            const uint8_t *first = arrays.position_bytes + arrays.position_offsets[i];
+            const uint8_t *last = arrays.position_bytes + arrays.position_offsets[i + 1];
+            const uint64_t terminator_count = std::count_if(first, last, [](uint8_t byte) { return byte < 0x80; });
+            if (terminator_count != value_count || (first != last && last[-1] >= 0x80))
+            {
+                throw std::runtime_error("Index file has invalid positions"s);
+            }
+        }
+    }
+    return file;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "index_segment.h"
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &path);
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile();
+
+    const char *data() const;
+    size_t size() const;
+
+private:
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Contents of an index file. The views and arrays point into the mapping
+struct IndexFile
+{
+    std::shared_ptr<const MappedFile> mapping;
+    std::vector<std::string_view> stop_words;
+    // Word of every segment term
+    std::vector<std::string_view> terms;
+    SegmentArrays arrays;
+};
+
+// Writes the stop words and the segment in a versioned, checksummed binary format.
+// The file is written next to path and renamed over it, so readers never see a partial index.
+// The format uses the byte order of the machine; other machines refuse to open the file
+void WriteIndexFile(const std::string &path, const std::set<std::string, std::less<>> &stop_words, const IndexSegment &segment);
+// Maps the file and checks its header, checksum and section layout; throws std::runtime_error if any is wrong
+IndexFile ReadIndexFile(const std::string &path);
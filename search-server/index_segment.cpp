@@ -0,0 +1,285 @@
+#include "index_segment.h"
+#include <algorithm>
+#include <tuple>
+
+struct IndexSegment::OwnedArrays
+{
+    std::vector<DocumentData> documents;
+    std::vector<DocumentIdOrdinal> document_ordinals;
+    std::vector<uint64_t> forward_offsets;
+    std::vector<uint32_t> forward_terms;
+    std::vector<uint32_t> forward_counts;
+    std::vector<uint64_t> posting_offsets;
+    std::vector<uint64_t> posting_block_offsets;
+    std::vector<PostingBlock> posting_blocks;
+    std::vector<uint32_t> posting_words;
+    std::vector<double> max_term_freqs;
+    std::vector<uint64_t> position_offsets;
+    std::vector<uint8_t> position_bytes;
+};
+
+IndexSegment::IndexSegment(const std::vector<SegmentDocument> &documents, bool store_positions)
+{
+    auto owned = std::make_shared<OwnedArrays>();
+    // The first pass numbers the terms, fills the forward index and counts the documents of every term,
+    // so that the second pass can write each posting straight to its final place
+    std::unordered_map<TermId, uint32_t> term_numbers;
+    std::vector<uint64_t> document_freqs;
+    owned->documents.reserve(documents.size());
+    owned->document_ordinals.reserve(documents.size());
+    owned->forward_offsets.reserve(documents.size() + 1);
+    owned->forward_offsets.push_back(0);
+    if (store_positions)
+    {
+        owned->position_offsets.reserve(documents.size() + 1);
+        owned->position_offsets.push_back(0);
+    }
+    // Term and count of each word of the current document and where its positions start
+    std::vector<std::tuple<uint32_t, uint32_t, size_t>> document_terms;
+    for (const SegmentDocument &document : documents)
+    {
+        document_terms.clear();
+        size_t first_position = 0;
+        for (const WordCount &word_count : document.word_counts)
+        {
+            const auto [it, inserted] = term_numbers.try_emplace(word_count.term_id, static_cast<uint32_t>(term_ids_.size()));
+            if (inserted)
+            {
+                term_ids_.push_back(word_count.term_id);
+                term_words_.push_back(word_count.word);
+                document_freqs.push_back(0);
+            }
+            ++document_freqs[it->second];
+            document_terms.emplace_back(it->second, word_count.count, first_position);
+            first_position += word_count.count;
+        }
+        std::sort(document_terms.begin(), document_terms.end());
+        for (const auto &[term, count, positions] : document_terms)
+        {
+            owned->forward_terms.push_back(term);
+            owned->forward_counts.push_back(count);
+            if (store_positions)
+            {
+                EncodePositions(document.positions.data() + positions, count, owned->position_bytes);
+            }
+        }
+        if (store_positions)
+        {
+            owned->position_offsets.push_back(owned->position_bytes.size());
+        }
+        owned->forward_offsets.push_back(owned->forward_terms.size());
+        owned->document_ordinals.push_back({document.data.id, static_cast<DocumentOrdinal>(owned->documents.size())});
+        owned->documents.push_back(document.data);
+    }
+    std::sort(owned->document_ordinals.begin(), owned->document_ordinals.end(),
+              [](const DocumentIdOrdinal &lhs, const DocumentIdOrdinal &rhs)
+              { return lhs.id < rhs.id; });
+
+    owned->posting_offsets.resize(term_ids_.size() + 1);
+    for (size_t term = 0; term < term_ids_.size(); ++term)
+    {
+        owned->posting_offsets[term + 1] = owned->posting_offsets[term] + document_freqs[term];
+    }
+    std::vector<DocumentOrdinal> posting_ordinals(owned->forward_terms.size());
+    std::vector<uint32_t> posting_counts(owned->forward_terms.size());
+    owned->max_term_freqs.resize(term_ids_.size());
+    // Upper bounds must be computed exactly the way queries compute term frequencies
+    arrays_.documents = owned->documents.data();
+    // Reuses document_freqs as the write position of every posting list
+    std::copy(owned->posting_offsets.begin(), owned->posting_offsets.end() - 1, document_freqs.begin());
+    for (DocumentOrdinal ordinal = 0; ordinal < owned->documents.size(); ++ordinal)
+    {
+        for (uint64_t i = owned->forward_offsets[ordinal]; i < owned->forward_offsets[ordinal + 1]; ++i)
+        {
+            const uint32_t term = owned->forward_terms[i];
+            const uint64_t position = document_freqs[term]++;
+            posting_ordinals[position] = ordinal;
+            posting_counts[position] = owned->forward_counts[i];
+            owned->max_term_freqs[term] = std::max(owned->max_term_freqs[term], ComputeTermFreq(ordinal, owned->forward_counts[i]));
+        }
+    }
+
+    owned->posting_block_offsets.reserve(term_ids_.size() + 1);
+    owned->posting_block_offsets.push_back(0);
+    for (size_t term = 0; term < term_ids_.size(); ++term)
+    {
+        const uint64_t begin = owned->posting_offsets[term];
+        EncodePostings(posting_ordinals.data() + begin, posting_counts.data() + begin,
+                       owned->posting_offsets[term + 1] - begin, owned->posting_blocks, owned->posting_words);
+        owned->posting_block_offsets.push_back(owned->posting_blocks.size());
+    }
+    owned->posting_words.resize(owned->posting_words.size() + POSTING_WORD_PADDING);
+
+    arrays_ = {owned->documents.size(), term_ids_.size(), owned->posting_words.size(),
+               owned->documents.data(), owned->document_ordinals.data(),
+               owned->forward_offsets.data(), owned->forward_terms.data(), owned->forward_counts.data(),
+               owned->posting_offsets.data(), owned->posting_block_offsets.data(),
+               owned->posting_blocks.data(), owned->posting_words.data(), owned->max_term_freqs.data(),
+               owned->position_bytes.size(), store_positions ? owned->position_offsets.data() : nullptr,
+               owned->position_bytes.data()};
+    storage_ = std::move(owned);
+    IndexTermWords();
+    BuildFilterColumns();
+}
+
+IndexSegment::IndexSegment(const SegmentArrays &arrays, std::vector<TermId> term_ids,
+                           std::vector<std::string_view> term_words, std::shared_ptr<const void> storage)
+    : arrays_(arrays), storage_(std::move(storage)), term_ids_(std::move(term_ids)), term_words_(std::move(term_words))
+{
+    IndexTermWords();
+    BuildFilterColumns();
+}
+
+void IndexSegment::IndexTermWords()
+{
+    word_to_term_.reserve(term_words_.size());
+    for (uint32_t term = 0; term < term_words_.size(); ++term)
+    {
+        word_to_term_.emplace(term_words_[term], term);
+    }
+    term_trie_ = TermTrie(term_words_);
+}
+
+void IndexSegment::BuildFilterColumns()
+{
+    for (auto &bitmap : status_bitmaps_)
+    {
+        bitmap.assign((arrays_.document_count + 63) / 64, 0);
+    }
+    ratings_.resize(arrays_.document_count);
+    for (DocumentOrdinal ordinal = 0; ordinal < arrays_.document_count; ++ordinal)
+    {
+        const DocumentData &document = arrays_.documents[ordinal];
+        status_bitmaps_[static_cast<size_t>(document.status)][ordinal / 64] |= uint64_t{1} << (ordinal % 64);
+        ratings_[ordinal] = document.rating;
+    }
+}
+
+DocumentOrdinal IndexSegment::FindFilterCandidate(DocumentOrdinal ordinal, const DocumentFilter &filter) const
+{
+    const auto ordinal_count = static_cast<DocumentOrdinal>(arrays_.document_count);
+    if (!filter.status || ordinal >= ordinal_count)
+    {
+        return std::min(ordinal, ordinal_count);
+    }
+    const std::vector<uint64_t> &bitmap = status_bitmaps_[static_cast<size_t>(*filter.status)];
+    size_t word = ordinal / 64;
+    uint64_t bits = bitmap[word] & (~uint64_t{0} << (ordinal % 64));
+    while (bits == 0)
+    {
+        if (++word == bitmap.size())
+        {
+            return ordinal_count;
+        }
+        bits = bitmap[word];
+    }
+    return static_cast<DocumentOrdinal>(word * 64 + __builtin_ctzll(bits));
+}
+
+size_t IndexSegment::GetOrdinalCount() const
+{
+    return arrays_.document_count;
+}
+
+const DocumentData &IndexSegment::GetDocument(DocumentOrdinal ordinal) const
+{
+    return arrays_.documents[ordinal];
+}
+
+std::optional<DocumentOrdinal> IndexSegment::FindOrdinal(int document_id) const
+{
+    const DocumentIdOrdinal *end = arrays_.document_ordinals + arrays_.document_count;
+    const auto it = std::lower_bound(arrays_.document_ordinals, end, document_id,
+                                     [](const DocumentIdOrdinal &entry, int id)
+                                     { return entry.id < id; });
+    if (it != end && it->id == document_id)
+    {
+        return it->ordinal;
+    }
+    return std::nullopt;
+}
+
+size_t IndexSegment::GetTermCount() const
+{
+    return arrays_.term_count;
+}
+
+std::optional<uint32_t> IndexSegment::FindTerm(std::string_view word) const
+{
+    if (const auto it = word_to_term_.find(word); it != word_to_term_.end())
+    {
+        return it->second;
+    }
+    return std::nullopt;
+}
+
+const TermTrie &IndexSegment::GetTermTrie() const
+{
+    return term_trie_;
+}
+
+bool IndexSegment::HasTerm(DocumentOrdinal ordinal, uint32_t term) const
+{
+    return std::binary_search(arrays_.forward_terms + arrays_.forward_offsets[ordinal],
+                              arrays_.forward_terms + arrays_.forward_offsets[ordinal + 1], term);
+}
+
+bool IndexSegment::HasPositions() const
+{
+    return arrays_.position_offsets != nullptr;
+}
+
+bool IndexSegment::GetPositions(DocumentOrdinal ordinal, uint32_t term, std::vector<uint32_t> &positions) const
+{
+    const uint32_t *first = arrays_.forward_terms + arrays_.forward_offsets[ordinal];
+    const uint32_t *last = arrays_.forward_terms + arrays_.forward_offsets[ordinal + 1];
+    const uint32_t *entry = std::lower_bound(first, last, term);
+    if (entry == last || *entry != term)
+    {
+        return false;
+    }
+    const uint8_t *bytes = arrays_.position_bytes + arrays_.position_offsets[ordinal];
+    const uint32_t *counts = arrays_.forward_counts + arrays_.forward_offsets[ordinal];
+    for (const uint32_t *skipped = first; skipped != entry; ++skipped)
+    {
+        bytes = SkipPositions(bytes, counts[skipped - first]);
+    }
+    const uint32_t count = counts[entry - first];
+    positions.resize(count);
+    DecodePositions(bytes, count, positions.data());
+    return true;
+}
+
+void IndexSegment::GetDocumentPositions(DocumentOrdinal ordinal, std::vector<uint32_t> &positions) const
+{
+    const uint8_t *bytes = arrays_.position_bytes + arrays_.position_offsets[ordinal];
+    for (uint64_t i = arrays_.forward_offsets[ordinal]; i < arrays_.forward_offsets[ordinal + 1]; ++i)
+    {
+        const size_t first = positions.size();
+        positions.resize(first + arrays_.forward_counts[i]);
+        bytes = DecodePositions(bytes, arrays_.forward_counts[i], positions.data() + first);
+    }
+}
+
+TermId IndexSegment::GetTermId(uint32_t term) const
+{
+    return term_ids_[term];
+}
+
+std::string_view IndexSegment::GetTermWord(uint32_t term) const
+{
+    return term_words_[term];
+}
+
+PostingList IndexSegment::GetPostings(uint32_t term) const
+{
+    const uint64_t first_block = arrays_.posting_block_offsets[term];
+    return PostingList(arrays_.posting_blocks + first_block, arrays_.posting_block_offsets[term + 1] - first_block,
+                       arrays_.posting_words, arrays_.posting_offsets[term + 1] - arrays_.posting_offsets[term],
+                       arrays_.max_term_freqs[term]);
+}
+
+const SegmentArrays &IndexSegment::GetArrays() const
+{
+    return arrays_;
+}
@@ -0,0 +1,172 @@
+#pragma once
+#include "document.h"
+#include "document_filter.h"
+#include "posting_list.h"
+#include "term_dictionary.h"
+#include "term_trie.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+struct DocumentData
+{
+    int id;
+    int rating;
+    DocumentStatus status;
+    // Number of words in the document except stop words
+    uint32_t word_count;
+};
+
+struct DocumentIdOrdinal
+{
+    int id;
+    DocumentOrdinal ordinal;
+};
+
+// Both are stored in index files as they are laid out in memory
+static_assert(std::is_trivially_copyable_v<DocumentData> && sizeof(DocumentData) == 16);
+static_assert(std::is_trivially_copyable_v<DocumentIdOrdinal> && sizeof(DocumentIdOrdinal) == 8);
+static_assert(std::is_trivially_copyable_v<PostingBlock>);
+
+struct WordCount
+{
+    TermId term_id;
+    // Points into the TermDictionary of the server that owns the segment
+    std::string_view word;
+    uint32_t count;
+};
+
+// A document in the form it is indexed: its attributes and how many times each of its words occurs
+struct SegmentDocument
+{
+    DocumentData data;
+    std::vector<WordCount> word_counts;
+    // Ascending token positions of every word, in the order of word_counts; empty unless positions are indexed
+    std::vector<uint32_t> positions;
+};
+
+// Flat arrays that make up a segment. Term t has posting_offsets[t + 1] - posting_offsets[t] postings
+// compressed into blocks [posting_block_offsets[t], posting_block_offsets[t + 1]),
+// document d has forward index entries [forward_offsets[d], forward_offsets[d + 1]) sorted by term.
+// If positions are indexed, the encoded positions of document d are position_bytes [position_offsets[d],
+// position_offsets[d + 1]), one list per forward index entry in the same order
+struct SegmentArrays
+{
+    size_t document_count = 0;
+    size_t term_count = 0;
+    size_t posting_word_count = 0;
+    const DocumentData *documents = nullptr;
+    // Sorted by document id
+    const DocumentIdOrdinal *document_ordinals = nullptr;
+    const uint64_t *forward_offsets = nullptr;
+    const uint32_t *forward_terms = nullptr;
+    const uint32_t *forward_counts = nullptr;
+    const uint64_t *posting_offsets = nullptr;
+    const uint64_t *posting_block_offsets = nullptr;
+    const PostingBlock *posting_blocks = nullptr;
+    const uint32_t *posting_words = nullptr;
+    const double *max_term_freqs = nullptr;
+    size_t position_byte_count = 0;
+    // nullptr if positions are not indexed
+    const uint64_t *position_offsets = nullptr;
+    const uint8_t *position_bytes = nullptr;
+};
+
+// Inverted index over a group of documents. It is never modified after construction,
+// so any number of threads may read it. Ordinals and term numbers are local to the segment
+class IndexSegment
+{
+public:
+    // Documents get ordinals in the order they are passed
+    explicit IndexSegment(const std::vector<SegmentDocument> &documents, bool store_positions = false);
+    // Wraps arrays kept alive by storage, e.g. a mapped index file; nothing is copied.
+    // term_ids and term_words give the TermDictionary entry of every segment term
+    IndexSegment(const SegmentArrays &arrays, std::vector<TermId> term_ids,
+                 std::vector<std::string_view> term_words, std::shared_ptr<const void> storage);
+
+    size_t GetOrdinalCount() const;
+    const DocumentData &GetDocument(DocumentOrdinal ordinal) const;
+    std::optional<DocumentOrdinal> FindOrdinal(int document_id) const;
+    // Reads the status bitmaps and the rating column only
+    bool MatchesFilter(DocumentOrdinal ordinal, const DocumentFilter &filter) const
+    {
+        return (!filter.status || IsSet(status_bitmaps_[static_cast<size_t>(*filter.status)], ordinal)) &&
+               (!filter.min_rating || ratings_[ordinal] >= *filter.min_rating);
+    }
+    // First ordinal not less than ordinal that may pass the filter, found by scanning its status bitmap
+    // a word at a time; GetOrdinalCount() if there is none
+    DocumentOrdinal FindFilterCandidate(DocumentOrdinal ordinal, const DocumentFilter &filter) const;
+    // Calls func(term, count) for every word of the document
+    template <typename Func>
+    void ForEachWordCount(DocumentOrdinal ordinal, Func func) const;
+    // Share of the document's words that are the term
+    double ComputeTermFreq(DocumentOrdinal ordinal, uint32_t term_count) const
+    {
+        return term_count / static_cast<double>(arrays_.documents[ordinal].word_count);
+    }
+
+    size_t GetTermCount() const;
+    std::optional<uint32_t> FindTerm(std::string_view word) const;
+    // Segment terms in lexicographic order, for prefix and fuzzy lookups
+    const TermTrie &GetTermTrie() const;
+    // Looks the term up in the document's forward index
+    bool HasTerm(DocumentOrdinal ordinal, uint32_t term) const;
+    bool HasPositions() const;
+    // Decodes the ascending positions of the term in the document, skipping the lists of the document's other terms
+    // without decoding them; false if the document does not contain the term
+    bool GetPositions(DocumentOrdinal ordinal, uint32_t term, std::vector<uint32_t> &positions) const;
+    // Decodes the position lists of all the document's terms, concatenated in ForEachWordCount order
+    void GetDocumentPositions(DocumentOrdinal ordinal, std::vector<uint32_t> &positions) const;
+    TermId GetTermId(uint32_t term) const;
+    std::string_view GetTermWord(uint32_t term) const;
+    PostingList GetPostings(uint32_t term) const;
+
+    const SegmentArrays &GetArrays() const;
+
+private:
+    struct OwnedArrays;
+
+    SegmentArrays arrays_;
+    std::shared_ptr<const void> storage_;
+    std::vector<TermId> term_ids_;
+    std::vector<std::string_view> term_words_;
+    // Every query word is looked up exactly, so that stays a hash lookup; the trie only serves expansions
+    std::unordered_map<std::string_view, uint32_t> word_to_term_;
+    TermTrie term_trie_;
+    // Bit ordinal of status_bitmaps_[s] is set if the document has status s
+    std::vector<uint64_t> status_bitmaps_[DOCUMENT_STATUS_COUNT];
+    std::vector<int> ratings_;
+
+    void IndexTermWords();
+    // Copies the attributes the filters read into columns
+    void BuildFilterColumns();
+
+    static bool IsSet(const std::vector<uint64_t> &bitmap, DocumentOrdinal ordinal)
+    {
+        return (bitmap[ordinal / 64] >> (ordinal % 64)) & 1;
+    }
+};
+
+template <typename Func>
+void IndexSegment::ForEachWordCount(DocumentOrdinal ordinal, Func func) const
+{
+    for (uint64_t i = arrays_.forward_offsets[ordinal]; i < arrays_.forward_offsets[ordinal + 1]; ++i)
+    {
+        func(arrays_.forward_terms[i], arrays_.forward_counts[i]);
+    }
+}
+
+// Tombstones of one segment. A published instance is never modified:
+// writers replace it with an updated copy, so readers keep a consistent view
+struct SegmentDeletions
+{
+    // Indexed by segment ordinal
+    std::vector<bool> is_deleted;
+    // Indexed by segment term; how many deleted documents each posting list still holds
+    std::vector<uint32_t> deleted_document_freqs;
+    size_t deleted_count = 0;
+};
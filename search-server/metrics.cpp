@@ -0,0 +1,253 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+using namespace std::literals::string_literals;
+
+namespace
+{
+    const char *const STAGE_NAMES[METRIC_STAGE_COUNT] = {"query", "match", "parse", "retrieval", "top_k"};
+    const char *const COUNTER_NAMES[METRIC_COUNTER_COUNT] = {"searched_segments", "scored_documents", "predicate_calls"};
+    const char *const COUNTER_HELP[METRIC_COUNTER_COUNT] = {
+        "Index segments searched by queries",
+        "Documents whose relevance was computed in full",
+        "Calls of document predicates and filters"};
+
+    // Written only by its thread; the atomics let snapshots read it at the same time
+    struct LatencyHistogram
+    {
+        std::array<std::atomic<uint64_t>, LATENCY_BUCKET_COUNT> buckets = {};
+        std::atomic<uint64_t> count = 0;
+        std::atomic<uint64_t> sum_nanoseconds = 0;
+    };
+
+    struct ThreadMetrics
+    {
+        std::array<LatencyHistogram, METRIC_STAGE_COUNT> stages;
+        std::array<std::atomic<uint64_t>, METRIC_COUNTER_COUNT> counters = {};
+    };
+
+    // With a single writer, a plain load and store is enough and avoids a locked instruction
+    void Increase(std::atomic<uint64_t> &value, uint64_t delta)
+    {
+        value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    void AddTo(MetricsSnapshot &snapshot, const ThreadMetrics &metrics)
+    {
+        for (size_t stage = 0; stage < METRIC_STAGE_COUNT; ++stage)
+        {
+            const LatencyHistogram &histogram = metrics.stages[stage];
+            LatencyHistogramSnapshot &total = snapshot.stages[stage];
+            for (size_t bucket = 0; bucket < LATENCY_BUCKET_COUNT; ++bucket)
+            {
+                total.buckets[bucket] += histogram.buckets[bucket].load(std::memory_order_relaxed);
+            }
+            total.count += histogram.count.load(std::memory_order_relaxed);
+            total.sum_nanoseconds += histogram.sum_nanoseconds.load(std::memory_order_relaxed);
+        }
+        for (size_t counter = 0; counter < METRIC_COUNTER_COUNT; ++counter)
+        {
+            snapshot.counters[counter] += metrics.counters[counter].load(std::memory_order_relaxed);
+        }
+    }
+
+    class MetricsRegistry
+    {
+    public:
+        void Register(const ThreadMetrics *metrics)
+        {
+            std::lock_guard guard(mutex_);
+            threads_.push_back(metrics);
+        }
+
+        // Keeps the totals of an exiting thread
+        void Retire(const ThreadMetrics *metrics)
+        {
+            std::lock_guard guard(mutex_);
+            AddTo(retired_, *metrics);
+            threads_.erase(std::find(threads_.begin(), threads_.end(), metrics));
+        }
+
+        MetricsSnapshot GetSnapshot() const
+        {
+            std::lock_guard guard(mutex_);
+            MetricsSnapshot snapshot = retired_;
+            for (const ThreadMetrics *metrics : threads_)
+            {
+                AddTo(snapshot, *metrics);
+            }
+            return snapshot;
+        }
+
+    private:
+        mutable std::mutex mutex_;
+        std::vector<const ThreadMetrics *> threads_;
+        MetricsSnapshot retired_;
+    };
+
+    // Never destroyed: threads of static pools, such as QueryExecutor::GetDefault(), exit after the static
+    // destructors run and still retire their metrics into it
+    MetricsRegistry &GetRegistry()
+    {
+        static auto *registry = new MetricsRegistry;
+        return *registry;
+    }
+
+    // Registers the metrics of the thread on first use and retires them when the thread exits
+    class ThreadMetricsHolder
+    {
+    public:
+        ThreadMetricsHolder()
+            : metrics_(std::make_unique<ThreadMetrics>())
+        {
+            GetRegistry().Register(metrics_.get());
+        }
+
+        ~ThreadMetricsHolder()
+        {
+            GetRegistry().Retire(metrics_.get());
+        }
+
+        ThreadMetrics &Get()
+        {
+            return *metrics_;
+        }
+
+    private:
+        std::unique_ptr<ThreadMetrics> metrics_;
+    };
+
+    ThreadMetrics &GetThreadMetrics()
+    {
+        static thread_local ThreadMetricsHolder holder;
+        return holder.Get();
+    }
+}
+
+size_t GetLatencyBucket(uint64_t nanoseconds)
+{
+    if (nanoseconds < (uint64_t{1} << LATENCY_SUB_BUCKET_BITS))
+    {
+        return static_cast<size_t>(nanoseconds);
+    }
+    const size_t exponent = 63 - __builtin_clzll(nanoseconds);
+    if (exponent >= LATENCY_MAX_EXPONENT)
+    {
+        return LATENCY_OVERFLOW_BUCKET;
+    }
+    const size_t shift = exponent - LATENCY_SUB_BUCKET_BITS;
+    const size_t sub_bucket = (nanoseconds >> shift) & ((size_t{1} << LATENCY_SUB_BUCKET_BITS) - 1);
+    return ((shift + 1) << LATENCY_SUB_BUCKET_BITS) + sub_bucket;
+}
+
+uint64_t GetLatencyBucketEnd(size_t bucket)
+{
+    if (bucket >= LATENCY_OVERFLOW_BUCKET)
+    {
+        return std::numeric_limits<uint64_t>::max();
+    }
+    const size_t sub_bucket_count = size_t{1} << LATENCY_SUB_BUCKET_BITS;
+    if (bucket < sub_bucket_count)
+    {
+        return bucket + 1;
+    }
+    const size_t shift = (bucket >> LATENCY_SUB_BUCKET_BITS) - 1;
+    const uint64_t sub_bucket = bucket & (sub_bucket_count - 1);
+    return (sub_bucket_count + sub_bucket + 1) << shift;
+}
+
+uint64_t LatencyHistogramSnapshot::GetPercentile(double share) const
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(share * count)));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < LATENCY_BUCKET_COUNT; ++bucket)
+    {
+        seen += buckets[bucket];
+        if (seen >= rank)
+        {
+            return bucket == LATENCY_OVERFLOW_BUCKET ? GetLatencyBucketEnd(bucket) : GetLatencyBucketEnd(bucket) - 1;
+        }
+    }
+    return GetLatencyBucketEnd(LATENCY_OVERFLOW_BUCKET);
+}
+
+void RecordStageLatency(MetricStage stage, uint64_t nanoseconds)
+{
+    LatencyHistogram &histogram = GetThreadMetrics().stages[static_cast<size_t>(stage)];
+    Increase(histogram.buckets[GetLatencyBucket(nanoseconds)], 1);
+    Increase(histogram.count, 1);
+    Increase(histogram.sum_nanoseconds, nanoseconds);
+}
+
+void AddToCounter(MetricCounter counter, uint64_t value)
+{
+    Increase(GetThreadMetrics().counters[static_cast<size_t>(counter)], value);
+}
+
+MetricsSnapshot GetMetricsSnapshot()
+{
+    return GetRegistry().GetSnapshot();
+}
+
+std::string FormatPrometheusMetrics(const MetricsSnapshot &snapshot)
+{
+    std::ostringstream output;
+    output.precision(17);
+    output << "# HELP search_server_stage_duration_seconds Latency of the search stages\n"s;
+    output << "# TYPE search_server_stage_duration_seconds histogram\n"s;
+    for (size_t stage = 0; stage < METRIC_STAGE_COUNT; ++stage)
+    {
+        const LatencyHistogramSnapshot &histogram = snapshot.stages[stage];
+        const std::string labels = "stage=\""s + STAGE_NAMES[stage] + "\""s;
+        // The first bucket of every power of two starts at it, so the sums end exactly on the boundaries
+        uint64_t cumulative_count = 0;
+        size_t bucket = 0;
+        for (size_t exponent = LATENCY_SUB_BUCKET_BITS; exponent <= LATENCY_MAX_EXPONENT; ++exponent)
+        {
+            const uint64_t boundary = uint64_t{1} << exponent;
+            for (; bucket < LATENCY_OVERFLOW_BUCKET && GetLatencyBucketEnd(bucket) <= boundary; ++bucket)
+            {
+                cumulative_count += histogram.buckets[bucket];
+            }
+            output << "search_server_stage_duration_seconds_bucket{"s << labels << ",le=\""s << boundary * 1e-9
+                   << "\"} "s << cumulative_count << '\n';
+        }
+        output << "search_server_stage_duration_seconds_bucket{"s << labels << ",le=\"+Inf\"} "s << histogram.count << '\n';
+        output << "search_server_stage_duration_seconds_sum{"s << labels << "} "s << histogram.sum_nanoseconds * 1e-9 << '\n';
+        output << "search_server_stage_duration_seconds_count{"s << labels << "} "s << histogram.count << '\n';
+    }
+    for (size_t counter = 0; counter < METRIC_COUNTER_COUNT; ++counter)
+    {
+        const std::string name = "search_server_"s + COUNTER_NAMES[counter] + "_total"s;
+        output << "# HELP "s << name << ' ' << COUNTER_HELP[counter] << '\n';
+        output << "# TYPE "s << name << " counter\n"s;
+        output << name << ' ' << snapshot.counters[counter] << '\n';
+    }
+    return output.str();
+}
+
+void WritePrometheusMetrics(const std::string &path, const MetricsSnapshot &snapshot)
+{
+    const std::string temporary_path = path + ".tmp"s;
+    {
+        std::ofstream output(temporary_path, std::ios::trunc);
+        output << FormatPrometheusMetrics(snapshot);
+        output.close();
+        if (!output)
+        {
+            throw std::runtime_error("Can not write metrics file "s + path);
+        }
+    }
+    std::filesystem::rename(temporary_path, path);
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Building with SEARCH_SERVER_DISABLE_METRICS strips the instrumentation out of the search paths;
+// the snapshot and export functions remain and report zeros
+#ifdef SEARCH_SERVER_DISABLE_METRICS
+const bool METRICS_ENABLED = false;
+#else
+const bool METRICS_ENABLED = true;
+#endif
+
+// Stages of the search paths with a latency histogram each
+enum class MetricStage
+{
+    // A whole FindTopDocuments call, including cache lookups
+    QUERY,
+    // A whole MatchDocument call
+    MATCH,
+    // Tokenizing the query and expanding prefix and fuzzy words
+    PARSE,
+    // Walking the posting lists of a segment and scoring the documents; both happen posting by posting,
+    // so they share a histogram. MaxScore pushes into the top here too
+    RETRIEVAL,
+    // Pushing the scored documents into the top, merging shard tops and sorting the result
+    TOP_K,
+};
+const size_t METRIC_STAGE_COUNT = 5;
+
+enum class MetricCounter
+{
+    SEARCHED_SEGMENTS,
+    // Documents whose score was computed in full
+    SCORED_DOCUMENTS,
+    // Calls of custom predicates and DocumentFilter checks; counted rather than timed,
+    // since a clock read costs more than a typical predicate
+    PREDICATE_CALLS,
+};
+const size_t METRIC_COUNTER_COUNT = 3;
+
+// Values below 2^LATENCY_SUB_BUCKET_BITS nanoseconds get a bucket each; above, every power of two is split
+// into 2^LATENCY_SUB_BUCKET_BITS buckets, so a bucket is at most 1/16 of its values wide, as in HdrHistogram
+const size_t LATENCY_SUB_BUCKET_BITS = 4;
+// Latencies of 2^LATENCY_MAX_EXPONENT nanoseconds (about 18 minutes) and more fall into an overflow bucket
+// after the regular ones, which has no upper bound and is exported in le="+Inf" only
+const size_t LATENCY_MAX_EXPONENT = 40;
+const size_t LATENCY_OVERFLOW_BUCKET = (LATENCY_MAX_EXPONENT - LATENCY_SUB_BUCKET_BITS + 1) << LATENCY_SUB_BUCKET_BITS;
+const size_t LATENCY_BUCKET_COUNT = LATENCY_OVERFLOW_BUCKET + 1;
+
+size_t GetLatencyBucket(uint64_t nanoseconds);
+// Smallest latency that does not fall into the bucket or any before it; the largest uint64_t for the overflow bucket
+uint64_t GetLatencyBucketEnd(size_t bucket);
+
+// Latencies of one stage summed over all threads
+struct LatencyHistogramSnapshot
+{
+    std::vector<uint64_t> buckets = std::vector<uint64_t>(LATENCY_BUCKET_COUNT);
+    uint64_t count = 0;
+    uint64_t sum_nanoseconds = 0;
+
+    // Largest latency in the bucket that holds the given share of the values, e.g. 0.99; 0 if there are none
+    // and the largest uint64_t if the share reaches into the overflow bucket
+    uint64_t GetPercentile(double share) const;
+};
+
+struct MetricsSnapshot
+{
+    std::array<LatencyHistogramSnapshot, METRIC_STAGE_COUNT> stages;
+    std::array<uint64_t, METRIC_COUNTER_COUNT> counters = {};
+
+    const LatencyHistogramSnapshot &GetStage(MetricStage stage) const
+    {
+        return stages[static_cast<size_t>(stage)];
+    }
+    uint64_t GetCounter(MetricCounter counter) const
+    {
+        return counters[static_cast<size_t>(counter)];
+    }
+};
+
+// Every thread records into histograms and counters of its own with relaxed atomic stores, so recording
+// never waits and never shares a cache line with another thread. A snapshot sums the live threads and the totals
+// that exited threads left behind
+void RecordStageLatency(MetricStage stage, uint64_t nanoseconds);
+void AddToCounter(MetricCounter counter, uint64_t value);
+// Totals since the start of the process
+MetricsSnapshot GetMetricsSnapshot();
+
+// Prometheus text exposition format. Histograms are exported in seconds with a bucket per power of two
+// nanoseconds, which are boundaries of the internal buckets, so the cumulative counts are exact
+std::string FormatPrometheusMetrics(const MetricsSnapshot &snapshot);
+// Written next to path and renamed over it, so a scraper never reads a partial file;
+// throws std::runtime_error if the file can not be written
+void WritePrometheusMetrics(const std::string &path, const MetricsSnapshot &snapshot);
+
+// Records the lifetime of the object as a latency of the stage
+class StageTimer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit StageTimer(MetricStage stage)
+        : stage_(stage) {}
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+    ~StageTimer()
+    {
+        const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_time_);
+        RecordStageLatency(stage_, static_cast<uint64_t>(duration.count()));
+    }
+
+private:
+    MetricStage stage_;
+    Clock::time_point start_time_ = Clock::now();
+};
+
+#define METRICS_CONCAT_INTERNAL(X, Y) X##Y
+#define METRICS_CONCAT(X, Y) METRICS_CONCAT_INTERNAL(X, Y)
+
+#ifdef SEARCH_SERVER_DISABLE_METRICS
+#define METRICS_TIME_STAGE(stage)
+#define METRICS_ADD(counter, value) static_cast<void>(value)
+#else
+// Times the rest of the enclosing scope
+#define METRICS_TIME_STAGE(stage) StageTimer METRICS_CONCAT(stageTimer, __LINE__)(stage)
+#define METRICS_ADD(counter, value) AddToCounter(counter, value)
+#endif
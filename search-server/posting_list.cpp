@@ -0,0 +1,241 @@
+#include "posting_list.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <utility>
+
+namespace
+{
+    unsigned GetBitWidth(uint32_t value)
+    {
+        unsigned bits = 0;
+        for (; value != 0; value >>= 1)
+        {
+            ++bits;
+        }
+        return bits;
+    }
+
+    void PackBits(const uint32_t *values, size_t count, unsigned bits, std::vector<uint32_t> &words)
+    {
+        uint64_t buffer = 0;
+        unsigned buffered = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            buffer |= static_cast<uint64_t>(values[i]) << buffered;
+            buffered += bits;
+            if (buffered >= 32)
+            {
+                words.push_back(static_cast<uint32_t>(buffer));
+                buffer >>= 32;
+                buffered -= 32;
+            }
+        }
+        if (buffered > 0)
+        {
+            words.push_back(static_cast<uint32_t>(buffer));
+        }
+    }
+
+    // Reads up to POSTING_WORD_PADDING words past the packed values. A constant width lets the compiler
+    // unroll and vectorize the loop
+    template <unsigned Bits>
+    void UnpackBits(const uint32_t *words, size_t count, uint32_t *values)
+    {
+        if constexpr (Bits == 0)
+        {
+            std::fill(values, values + count, 0);
+        }
+        else
+        {
+            const uint64_t mask = (uint64_t{1} << Bits) - 1;
+            for (size_t i = 0; i < count; ++i)
+            {
+                const size_t bit = i * Bits;
+                uint64_t window;
+                std::memcpy(&window, words + bit / 32, sizeof(window));
+                values[i] = static_cast<uint32_t>((window >> (bit % 32)) & mask);
+            }
+        }
+    }
+
+    using Unpacker = void (*)(const uint32_t *words, size_t count, uint32_t *values);
+
+    template <size_t... Bits>
+    constexpr std::array<Unpacker, sizeof...(Bits)> MakeUnpackers(std::index_sequence<Bits...>)
+    {
+        return {&UnpackBits<Bits>...};
+    }
+
+    // Indexed by bit width
+    constexpr auto UNPACKERS = MakeUnpackers(std::make_index_sequence<33>());
+}
+
+void EncodePostings(const DocumentOrdinal *ordinals, const uint32_t *counts, size_t size,
+                    std::vector<PostingBlock> &blocks, std::vector<uint32_t> &words)
+{
+    DocumentOrdinal previous = 0;
+    uint32_t deltas[POSTING_BLOCK_SIZE];
+    uint32_t stored_counts[POSTING_BLOCK_SIZE];
+    for (size_t begin = 0; begin < size; begin += POSTING_BLOCK_SIZE)
+    {
+        const size_t block_size = std::min(POSTING_BLOCK_SIZE, size - begin);
+        uint32_t max_delta = 0;
+        uint32_t max_count = 0;
+        for (size_t i = 0; i < block_size; ++i)
+        {
+            deltas[i] = ordinals[begin + i] - previous;
+            stored_counts[i] = counts[begin + i] - 1;
+            previous = ordinals[begin + i];
+            max_delta = std::max(max_delta, deltas[i]);
+            max_count = std::max(max_count, stored_counts[i]);
+        }
+        const PostingBlock block{words.size(), previous, static_cast<uint16_t>(block_size),
+                                 static_cast<uint8_t>(GetBitWidth(max_delta)), static_cast<uint8_t>(GetBitWidth(max_count))};
+        PackBits(deltas, block_size, block.delta_bits, words);
+        PackBits(stored_counts, block_size, block.count_bits, words);
+        blocks.push_back(block);
+    }
+}
+
+void EncodePositions(const uint32_t *positions, size_t count, std::vector<uint8_t> &bytes)
+{
+    uint32_t previous = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t gap = positions[i] - previous;
+        previous = positions[i];
+        while (gap >= 0x80)
+        {
+            bytes.push_back(static_cast<uint8_t>(gap | 0x80));
+            gap >>= 7;
+        }
+        bytes.push_back(static_cast<uint8_t>(gap));
+    }
+}
+
+const uint8_t *DecodePositions(const uint8_t *bytes, size_t count, uint32_t *positions)
+{
+    uint32_t position = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t gap = 0;
+        for (unsigned shift = 0;; shift += 7)
+        {
+            const uint8_t byte = *bytes++;
+            gap |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if (byte < 0x80)
+            {
+                break;
+            }
+        }
+        position += gap;
+        positions[i] = position;
+    }
+    return bytes;
+}
+
+const uint8_t *SkipPositions(const uint8_t *bytes, size_t count)
+{
+    // Every value ends with the only byte of it that has the high bit clear
+    for (; count > 0; ++bytes)
+    {
+        count -= *bytes < 0x80;
+    }
+    return bytes;
+}
+
+PostingList::PostingList(const PostingBlock *blocks, size_t block_count, const uint32_t *words, size_t size, double max_term_freq)
+    : blocks_(blocks), block_count_(block_count), words_(words), size_(size), max_term_freq_(max_term_freq) {}
+
+bool PostingList::Contains(DocumentOrdinal ordinal) const
+{
+    const size_t block = FindBlock(ordinal);
+    if (block == block_count_)
+    {
+        return false;
+    }
+    DocumentOrdinal ordinals[POSTING_BLOCK_SIZE];
+    uint32_t counts[POSTING_BLOCK_SIZE];
+    const size_t block_size = DecodeBlock(block, ordinals, counts);
+    return std::binary_search(ordinals, ordinals + block_size, ordinal);
+}
+
+size_t PostingList::size() const
+{
+    return size_;
+}
+
+bool PostingList::empty() const
+{
+    return size_ == 0;
+}
+
+double PostingList::GetMaxTermFreq() const
+{
+    return max_term_freq_;
+}
+
+size_t PostingList::GetBlockCount() const
+{
+    return block_count_;
+}
+
+size_t PostingList::FindBlock(DocumentOrdinal ordinal, size_t first_block) const
+{
+    return std::lower_bound(blocks_ + first_block, blocks_ + block_count_, ordinal,
+                            [](const PostingBlock &block, DocumentOrdinal ordinal)
+                            { return block.last_ordinal < ordinal; }) -
+           blocks_;
+}
+
+size_t PostingList::DecodeBlock(size_t block, DocumentOrdinal *ordinals, uint32_t *counts) const
+{
+    const PostingBlock &header = blocks_[block];
+    const uint32_t *words = words_ + header.offset;
+    UNPACKERS[header.delta_bits](words, header.size, ordinals);
+    UNPACKERS[header.count_bits](words + (header.size * header.delta_bits + 31) / 32, header.size, counts);
+    DocumentOrdinal ordinal = block > 0 ? blocks_[block - 1].last_ordinal : 0;
+    for (size_t i = 0; i < header.size; ++i)
+    {
+        ordinal += ordinals[i];
+        ordinals[i] = ordinal;
+        ++counts[i];
+    }
+    return header.size;
+}
+
+PostingIterator::PostingIterator(const PostingList &postings, DocumentOrdinal first, DocumentOrdinal last)
+    : postings_(postings), last_(last)
+{
+    LoadBlock(postings_.FindBlock(first));
+    if (block_size_ > 0)
+    {
+        position_ = std::lower_bound(ordinals_, ordinals_ + block_size_, first) - ordinals_;
+    }
+}
+
+bool PostingIterator::Seek(DocumentOrdinal ordinal)
+{
+    if (position_ == block_size_)
+    {
+        return false;
+    }
+    if (ordinals_[block_size_ - 1] < ordinal)
+    {
+        LoadBlock(postings_.FindBlock(ordinal, block_ + 1));
+        if (block_size_ == 0)
+        {
+            return false;
+        }
+    }
+    position_ = std::lower_bound(ordinals_ + position_, ordinals_ + block_size_, ordinal) - ordinals_;
+    return !IsEnd() && ordinals_[position_] == ordinal;
+}
+
+void PostingIterator::LoadBlock(size_t block)
+{
+    block_ = block;
+    position_ = 0;
+    block_size_ = block < postings_.GetBlockCount() ? postings_.DecodeBlock(block, ordinals_, counts_) : 0;
+}
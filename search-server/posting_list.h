@@ -0,0 +1,139 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Dense internal number of a document, assigned in the order documents are added
+using DocumentOrdinal = uint32_t;
+
+// Postings are compressed in blocks of this many entries
+const size_t POSTING_BLOCK_SIZE = 128;
+// Decoding reads whole 64-bit windows, so the packed words must be followed by this many readable words
+const size_t POSTING_WORD_PADDING = 1;
+
+// Skip entry of a compressed block. From word offset on, the block holds the ordinal deltas
+// and then the term counts minus one, each bit-packed with the smallest width that fits the block
+struct PostingBlock
+{
+    uint64_t offset;
+    DocumentOrdinal last_ordinal;
+    uint16_t size;
+    uint8_t delta_bits;
+    uint8_t count_bits;
+};
+
+static_assert(sizeof(PostingBlock) == 16);
+
+// Compresses postings with ascending ordinals and positive term counts, appending them to blocks and words
+void EncodePostings(const DocumentOrdinal *ordinals, const uint32_t *counts, size_t size,
+                    std::vector<PostingBlock> &blocks, std::vector<uint32_t> &words);
+
+// Appends ascending token positions as LEB128 varints of their gaps
+void EncodePositions(const uint32_t *positions, size_t count, std::vector<uint8_t> &bytes);
+// Decodes count positions written by EncodePositions; returns the byte after them
+const uint8_t *DecodePositions(const uint8_t *bytes, size_t count, uint32_t *positions);
+// Returns the byte after count encoded positions without decoding them
+const uint8_t *SkipPositions(const uint8_t *bytes, size_t count);
+
+// Postings of a single term: document ordinals in ascending order and the number of times the term
+// occurs in each document. A view of compressed blocks owned by an IndexSegment
+class PostingList
+{
+public:
+    PostingList(const PostingBlock *blocks, size_t block_count, const uint32_t *words, size_t size, double max_term_freq);
+
+    // Decodes only the block that may hold the ordinal
+    bool Contains(DocumentOrdinal ordinal) const;
+    size_t size() const;
+    bool empty() const;
+    // Upper bound of the term frequency over the list, used to prune documents during retrieval
+    double GetMaxTermFreq() const;
+
+    size_t GetBlockCount() const;
+    // First block whose last ordinal is not less than ordinal; GetBlockCount() if there is none
+    size_t FindBlock(DocumentOrdinal ordinal, size_t first_block = 0) const;
+    // Writes the ordinals and term counts of the block; returns the block size
+    size_t DecodeBlock(size_t block, DocumentOrdinal *ordinals, uint32_t *counts) const;
+    // Calls func(ordinal, term_count) for the postings with ordinals in [first, last), decoding block by block
+    template <typename Func>
+    void ForEachPosting(DocumentOrdinal first, DocumentOrdinal last, Func func) const;
+
+private:
+    const PostingBlock *blocks_;
+    size_t block_count_;
+    const uint32_t *words_;
+    size_t size_;
+    double max_term_freq_;
+};
+
+// Walks the postings with ordinals in [first, last), decoding one block at a time
+class PostingIterator
+{
+public:
+    PostingIterator(const PostingList &postings, DocumentOrdinal first, DocumentOrdinal last);
+
+    const PostingList &GetPostings() const
+    {
+        return postings_;
+    }
+
+    bool IsEnd() const
+    {
+        return position_ == block_size_ || ordinals_[position_] >= last_;
+    }
+
+    DocumentOrdinal GetOrdinal() const
+    {
+        return ordinals_[position_];
+    }
+
+    uint32_t GetTermCount() const
+    {
+        return counts_[position_];
+    }
+
+    void Next()
+    {
+        if (++position_ == block_size_)
+        {
+            LoadBlock(block_ + 1);
+        }
+    }
+
+    // Moves to the first posting with an ordinal not less than ordinal, skipping whole blocks;
+    // true if that posting belongs to the document
+    bool Seek(DocumentOrdinal ordinal);
+
+private:
+    PostingList postings_;
+    DocumentOrdinal last_;
+    size_t block_ = 0;
+    size_t block_size_ = 0;
+    size_t position_ = 0;
+    DocumentOrdinal ordinals_[POSTING_BLOCK_SIZE];
+    uint32_t counts_[POSTING_BLOCK_SIZE];
+
+    void LoadBlock(size_t block);
+};
+
+template <typename Func>
+void PostingList::ForEachPosting(DocumentOrdinal first, DocumentOrdinal last, Func func) const
+{
+    DocumentOrdinal ordinals[POSTING_BLOCK_SIZE];
+    uint32_t counts[POSTING_BLOCK_SIZE];
+    for (size_t block = FindBlock(first); block < block_count_; ++block)
+    {
+        const size_t block_size = DecodeBlock(block, ordinals, counts);
+        for (size_t i = 0; i < block_size; ++i)
+        {
+            if (ordinals[i] >= last)
+            {
+                return;
+            }
+            if (ordinals[i] >= first)
+            {
+                func(ordinals[i], counts[i]);
+            }
+        }
+    }
+}
@@ -1,29 +1,224 @@
 #include "process_queries.h"
-#include "execution"
+#include <algorithm>
+#include <atomic>
+#include <utility>
 
 std::vector<std::vector<Document>> ProcessQueries(
     const SearchServer &search_server,
     const std::vector<std::string> &queries)
 {
-    std::vector<std::vector<Document>> res(queries.size());
-    std::transform(std::execution::par, queries.begin(), queries.end(), res.begin(), [&search_server](const std::string &query)
-                   { return search_server.FindTopDocuments(query); });
-    return res;
+    return ProcessQueries(QueryExecutor::GetDefault(), search_server, queries);
 }
 
-std::vector<Document> ProcessQueriesJoined(
+std::vector<std::vector<Document>> ProcessQueries(
+    QueryExecutor &executor,
     const SearchServer &search_server,
     const std::vector<std::string> &queries)
 {
-    return std::transform_reduce(
-        std::execution::par, queries.begin(), queries.end(), std::vector<Document>{},
-        [](std::vector<Document> lhs, const std::vector<Document> &rhs)
+    std::vector<std::vector<Document>> res(queries.size());
+    executor.ParallelFor(queries.size(), [&search_server, &queries, &res](size_t i)
+                         { res[i] = search_server.FindTopDocuments(queries[i]); });
+    return res;
+}
+
+struct JoinedQueryResults::State
+{
+    const SearchServer &search_server;
+    const std::vector<std::string> queries;
+    // Query i owns slots [i * MAX_RESULT_DOCUMENT_COUNT, (i + 1) * MAX_RESULT_DOCUMENT_COUNT)
+    std::vector<Document> documents;
+    std::vector<size_t> document_counts;
+    std::vector<std::exception_ptr> exceptions;
+    std::atomic<size_t> next_query = 0;
+    std::atomic<bool> is_stopped = false;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<bool> is_done;
+    // Queries being run; queued tasks are not counted, since they only check is_stopped once they run
+    size_t running_query_count = 0;
+
+    State(const SearchServer &search_server, std::vector<std::string> batch)
+        : search_server(search_server), queries(std::move(batch)), documents(queries.size() * MAX_RESULT_DOCUMENT_COUNT),
+          document_counts(queries.size()), exceptions(queries.size()), is_done(queries.size())
+    {
+    }
+
+    // Takes the next query nobody has taken; false when all are taken or the results were destroyed
+    bool RunNextQuery()
+    {
+        {
+            std::lock_guard guard(mutex);
+            if (is_stopped)
+            {
+                return false;
+            }
+            ++running_query_count;
+        }
+        const size_t query = next_query++;
+        if (query >= queries.size())
+        {
+            {
+                std::lock_guard guard(mutex);
+                --running_query_count;
+            }
+            changed.notify_all();
+            return false;
+        }
+        try
+        {
+            const std::vector<Document> found = search_server.FindTopDocuments(queries[query]);
+            std::copy(found.begin(), found.end(), documents.begin() + query * MAX_RESULT_DOCUMENT_COUNT);
+            document_counts[query] = found.size();
+        }
+        catch (...)
         {
-            lhs.insert(lhs.end(), rhs.begin(), rhs.end());
-            return lhs;
-        },
-        [&search_server](const std::string &query)
+            exceptions[query] = std::current_exception();
+        }
+        {
+            std::lock_guard guard(mutex);
+            is_done[query] = true;
+            --running_query_count;
+        }
+        changed.notify_all();
+        return true;
+    }
+};
+
+JoinedQueryResults::JoinedQueryResults(QueryExecutor &executor, const SearchServer &search_server,
+                                       std::vector<std::string> queries)
+    : state_(std::make_shared<State>(search_server, std::move(queries)))
+{
+    const size_t task_count = std::min(executor.GetThreadCount(), state_->queries.size());
+    for (size_t i = 0; i < task_count; ++i)
+    {
+        executor.Submit([state = state_]
+                        {
+                            while (state->RunNextQuery())
+                            {
+                            } });
+    }
+}
+
+JoinedQueryResults::~JoinedQueryResults()
+{
+    if (!state_)
+    {
+        return;
+    }
+    // Running queries still read the server and the queries, which may go away after this returns. Tasks still
+    // in the queue are not waited for: if this runs on a worker of the same executor, they may never start
+    std::unique_lock lock(state_->mutex);
+    state_->is_stopped = true;
+    state_->changed.wait(lock, [this]
+                         { return state_->running_query_count == 0; });
+}
+
+JoinedQueryResults::Iterator JoinedQueryResults::begin() const
+{
+    return Iterator(this, 0);
+}
+
+JoinedQueryResults::Iterator JoinedQueryResults::end() const
+{
+    return Iterator(this, GetQueryCount());
+}
+
+size_t JoinedQueryResults::GetQueryCount() const
+{
+    return state_->queries.size();
+}
+
+std::vector<Document> JoinedQueryResults::GetQueryDocuments(size_t query) const
+{
+    const size_t document_count = WaitForQuery(query);
+    return std::vector<Document>(GetDocuments(query), GetDocuments(query) + document_count);
+}
+
+size_t JoinedQueryResults::WaitForQuery(size_t query) const
+{
+    State &state = *state_;
+    std::unique_lock lock(state.mutex);
+    while (!state.is_done[query])
+    {
+        // Taking queries in order guarantees progress even if the executor is busy or is the calling thread
+        lock.unlock();
+        if (!state.RunNextQuery())
         {
-            return search_server.FindTopDocuments(query);
-        });
-}
\ No newline at end of file
+            lock.lock();
+            state.changed.wait(lock, [&state, query]
+                               { return state.is_done[query]; });
+        }
+        else
+        {
+            lock.lock();
+        }
+    }
+    if (state.exceptions[query])
+    {
+        std::rethrow_exception(state.exceptions[query]);
+    }
+    return state.document_counts[query];
+}
+
+const Document *JoinedQueryResults::GetDocuments(size_t query) const
+{
+    return state_->documents.data() + query * MAX_RESULT_DOCUMENT_COUNT;
+}
+
+JoinedQueryResults::Iterator::Iterator(const JoinedQueryResults *results, size_t query)
+    : results_(results), query_(query)
+{
+    SkipEmptyQueries();
+}
+
+JoinedQueryResults::Iterator::reference JoinedQueryResults::Iterator::operator*() const
+{
+    return results_->GetDocuments(query_)[position_];
+}
+
+JoinedQueryResults::Iterator::pointer JoinedQueryResults::Iterator::operator->() const
+{
+    return &**this;
+}
+
+JoinedQueryResults::Iterator &JoinedQueryResults::Iterator::operator++()
+{
+    ++position_;
+    SkipEmptyQueries();
+    return *this;
+}
+
+bool JoinedQueryResults::Iterator::operator==(const Iterator &other) const
+{
+    return query_ == other.query_ && position_ == other.position_;
+}
+
+bool JoinedQueryResults::Iterator::operator!=(const Iterator &other) const
+{
+    return !(*this == other);
+}
+
+void JoinedQueryResults::Iterator::SkipEmptyQueries()
+{
+    while (query_ < results_->GetQueryCount() && position_ == results_->WaitForQuery(query_))
+    {
+        ++query_;
+        position_ = 0;
+    }
+}
+
+JoinedQueryResults ProcessQueriesJoined(
+    const SearchServer &search_server,
+    std::vector<std::string> queries)
+{
+    return ProcessQueriesJoined(QueryExecutor::GetDefault(), search_server, std::move(queries));
+}
+
+JoinedQueryResults ProcessQueriesJoined(
+    QueryExecutor &executor,
+    const SearchServer &search_server,
+    std::vector<std::string> queries)
+{
+    return JoinedQueryResults(executor, search_server, std::move(queries));
+}
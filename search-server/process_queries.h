@@ -1,11 +1,83 @@
 #pragma once
+#include <condition_variable>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <vector>
+#include "query_executor.h"
 #include "search_server.h"
 
+// Both run the queries on QueryExecutor::GetDefault() unless an executor is given
 std::vector<std::vector<Document>> ProcessQueries(
     const SearchServer &search_server,
     const std::vector<std::string> &queries);
+std::vector<std::vector<Document>> ProcessQueries(
+    QueryExecutor &executor,
+    const SearchServer &search_server,
+    const std::vector<std::string> &queries);
+
+// Documents found by a batch of queries, joined in query order. Queries are taken in order by the executor
+// while the caller iterates, so the documents of the first queries are available before the batch is done.
+// They are kept in one buffer allocated up front with MAX_RESULT_DOCUMENT_COUNT slots per query.
+// The object keeps its own copy of the queries, so a temporary batch is fine; the server and the executor
+// must outlive it. Destroying it stops the remaining queries
+class JoinedQueryResults
+{
+public:
+    // Input iterator; advancing waits for the next query to finish and rethrows its exception
+    class Iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Document;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Document *;
+        using reference = const Document &;
+
+        Iterator(const JoinedQueryResults *results, size_t query);
+
+        reference operator*() const;
+        pointer operator->() const;
+        Iterator &operator++();
+        bool operator==(const Iterator &other) const;
+        bool operator!=(const Iterator &other) const;
+
+    private:
+        const JoinedQueryResults *results_;
+        size_t query_;
+        size_t position_ = 0;
 
-std::vector<Document> ProcessQueriesJoined(
+        // Moves to the first document at or after the current position, skipping queries without documents
+        void SkipEmptyQueries();
+    };
+
+    JoinedQueryResults(QueryExecutor &executor, const SearchServer &search_server, std::vector<std::string> queries);
+    JoinedQueryResults(JoinedQueryResults &&) = default;
+    JoinedQueryResults &operator=(JoinedQueryResults &&) = delete;
+    ~JoinedQueryResults();
+
+    Iterator begin() const;
+    Iterator end() const;
+    size_t GetQueryCount() const;
+    // Waits for the query and returns its documents; rethrows the exception of the query
+    std::vector<Document> GetQueryDocuments(size_t query) const;
+
+private:
+    struct State;
+
+    // Shared with the executor tasks, which may still be finishing a query when the object is destroyed
+    std::shared_ptr<State> state_;
+
+    size_t WaitForQuery(size_t query) const;
+    const Document *GetDocuments(size_t query) const;
+};
+
+// Results of all queries in query order
+JoinedQueryResults ProcessQueriesJoined(
+    const SearchServer &search_server,
+    std::vector<std::string> queries);
+JoinedQueryResults ProcessQueriesJoined(
+    QueryExecutor &executor,
     const SearchServer &search_server,
-    const std::vector<std::string> &queries);
\ No newline at end of file
+    std::vector<std::string> queries);
@@ -0,0 +1,74 @@
+#include "query_cache.h"
+#include <algorithm>
+#include <functional>
+
+QueryCache::QueryCache(size_t capacity)
+    : shard_capacity_(std::max<size_t>(1, (capacity + QUERY_CACHE_SHARD_COUNT - 1) / QUERY_CACHE_SHARD_COUNT)),
+      shards_(std::make_unique<Shard[]>(QUERY_CACHE_SHARD_COUNT)) {}
+
+std::optional<std::vector<Document>> QueryCache::Find(const std::string &key, uint64_t generation)
+{
+    Shard &shard = GetShard(key);
+    std::lock_guard guard(shard.mutex);
+    const auto position = shard.positions.find(key);
+    if (position == shard.positions.end())
+    {
+        ++misses_;
+        return std::nullopt;
+    }
+    const auto entry = position->second;
+    if (entry->generation != generation)
+    {
+        shard.positions.erase(position);
+        shard.entries.erase(entry);
+        ++misses_;
+        return std::nullopt;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, entry);
+    ++hits_;
+    return entry->documents;
+}
+
+void QueryCache::Insert(std::string key, uint64_t generation, std::vector<Document> documents)
+{
+    Shard &shard = GetShard(key);
+    std::lock_guard guard(shard.mutex);
+    const auto position = shard.positions.find(key);
+    if (position != shard.positions.end())
+    {
+        // Another thread has computed the same query; the newer generation wins
+        const auto entry = position->second;
+        if (entry->generation <= generation)
+        {
+            entry->generation = generation;
+            entry->documents = std::move(documents);
+        }
+        shard.entries.splice(shard.entries.begin(), shard.entries, entry);
+        return;
+    }
+    shard.entries.push_front({std::move(key), generation, std::move(documents)});
+    shard.positions.emplace(shard.entries.front().key, shard.entries.begin());
+    if (shard.entries.size() > shard_capacity_)
+    {
+        shard.positions.erase(shard.entries.back().key);
+        shard.entries.pop_back();
+    }
+}
+
+QueryCacheStats QueryCache::GetStats() const
+{
+    QueryCacheStats stats;
+    stats.hits = hits_;
+    stats.misses = misses_;
+    for (size_t i = 0; i < QUERY_CACHE_SHARD_COUNT; ++i)
+    {
+        std::lock_guard guard(shards_[i].mutex);
+        stats.size += shards_[i].entries.size();
+    }
+    return stats;
+}
+
+QueryCache::Shard &QueryCache::GetShard(std::string_view key) const
+{
+    return shards_[std::hash<std::string_view>{}(key) % QUERY_CACHE_SHARD_COUNT];
+}
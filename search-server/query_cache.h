@@ -0,0 +1,62 @@
+#pragma once
+#include "document.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Number of independently locked parts of a QueryCache
+const size_t QUERY_CACHE_SHARD_COUNT = 16;
+
+struct QueryCacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // Entries currently held, including ones computed for an older index generation
+    size_t size = 0;
+};
+
+// Least recently used search results keyed by a normalized query. The keys are split between shards
+// with their own lock, so concurrent queries rarely wait for each other.
+// Every entry remembers the index generation it was computed for; a lookup with any other generation
+// is a miss and drops the entry, so writers never have to walk the cache
+class QueryCache
+{
+public:
+    // Holds at most capacity entries, rounded up to a multiple of QUERY_CACHE_SHARD_COUNT
+    explicit QueryCache(size_t capacity);
+
+    std::optional<std::vector<Document>> Find(const std::string &key, uint64_t generation);
+    void Insert(std::string key, uint64_t generation, std::vector<Document> documents);
+    QueryCacheStats GetStats() const;
+
+private:
+    struct Entry
+    {
+        std::string key;
+        uint64_t generation;
+        std::vector<Document> documents;
+    };
+    struct Shard
+    {
+        std::mutex mutex;
+        // Most recently used first
+        std::list<Entry> entries;
+        // Keys point into entries, whose nodes never move
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> positions;
+    };
+
+    size_t shard_capacity_;
+    std::unique_ptr<Shard[]> shards_;
+    std::atomic<uint64_t> hits_ = 0;
+    std::atomic<uint64_t> misses_ = 0;
+
+    Shard &GetShard(std::string_view key) const;
+};
@@ -0,0 +1,129 @@
+#include "query_executor.h"
+#include "search_server.h"
+
+namespace
+{
+    // Executor and worker index of the calling thread
+    thread_local const QueryExecutor *current_executor = nullptr;
+    thread_local size_t current_worker = 0;
+}
+
+QueryExecutor::QueryExecutor(size_t thread_count)
+{
+    thread_count = std::max<size_t>(thread_count, 1);
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+        queues_.push_back(std::make_unique<WorkerQueue>());
+    }
+    threads_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+        threads_.emplace_back(&QueryExecutor::RunWorker, this, i);
+    }
+}
+
+QueryExecutor::~QueryExecutor()
+{
+    {
+        std::lock_guard guard(sleep_mutex_);
+        stopping_ = true;
+    }
+    wake_condition_.notify_all();
+    for (std::thread &thread : threads_)
+    {
+        thread.join();
+    }
+}
+
+size_t QueryExecutor::GetThreadCount() const
+{
+    return queues_.size();
+}
+
+size_t QueryExecutor::GetCurrentWorkerIndex() const
+{
+    return current_executor == this ? current_worker : GetThreadCount();
+}
+
+std::future<std::vector<Document>> QueryExecutor::SubmitQuery(const SearchServer &search_server, std::string raw_query)
+{
+    return Submit([&search_server, raw_query = std::move(raw_query)]
+                  { return search_server.FindTopDocuments(raw_query); });
+}
+
+QueryExecutor &QueryExecutor::GetDefault()
+{
+    static QueryExecutor executor;
+    return executor;
+}
+
+void QueryExecutor::Push(Task task)
+{
+    // Workers keep the tasks they spawn, other threads spread theirs over all deques
+    const size_t worker = GetCurrentWorkerIndex();
+    WorkerQueue &queue = *queues_[worker < GetThreadCount() ? worker : next_queue_++ % GetThreadCount()];
+    {
+        // Counted before it becomes visible, so a thief never decrements below zero. Taking the mutex
+        // orders the increment before the check of a worker about to sleep
+        std::lock_guard guard(sleep_mutex_);
+        ++queued_count_;
+    }
+    {
+        std::lock_guard guard(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    wake_condition_.notify_one();
+}
+
+bool QueryExecutor::TryRunTask(size_t worker)
+{
+    const size_t thread_count = GetThreadCount();
+    const size_t first = worker < thread_count ? worker : 0;
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+        WorkerQueue &queue = *queues_[(first + i) % thread_count];
+        Task task;
+        {
+            std::lock_guard guard(queue.mutex);
+            if (queue.tasks.empty())
+            {
+                continue;
+            }
+            // The owner takes the newest task, whose data is likely still in its cache; thieves take the oldest
+            if (i == 0 && worker < thread_count)
+            {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+        }
+        --queued_count_;
+        task();
+        return true;
+    }
+    return false;
+}
+
+void QueryExecutor::RunWorker(size_t worker)
+{
+    current_executor = this;
+    current_worker = worker;
+    while (true)
+    {
+        if (TryRunTask(worker))
+        {
+            continue;
+        }
+        std::unique_lock lock(sleep_mutex_);
+        wake_condition_.wait(lock, [this]
+                             { return stopping_ || queued_count_ > 0; });
+        if (stopping_ && queued_count_ == 0)
+        {
+            return;
+        }
+    }
+}
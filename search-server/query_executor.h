@@ -0,0 +1,137 @@
+#pragma once
+#include "document.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class SearchServer;
+
+// Fixed pool of worker threads for serving queries. Every worker has its own task deque: it takes new work
+// from the back of its own deque and steals from the front of the others when that runs dry.
+// Workers live as long as the executor, so the per-thread scratch of SearchServer (the score accumulator)
+// is allocated once per worker and reused by every query it runs
+class QueryExecutor
+{
+public:
+    explicit QueryExecutor(size_t thread_count = std::max(1u, std::thread::hardware_concurrency()));
+    QueryExecutor(const QueryExecutor &) = delete;
+    QueryExecutor &operator=(const QueryExecutor &) = delete;
+    // Runs the tasks already submitted, then joins the workers
+    ~QueryExecutor();
+
+    size_t GetThreadCount() const;
+    // Index of the worker running the call, for per-worker state; GetThreadCount() outside the pool
+    size_t GetCurrentWorkerIndex() const;
+
+    // Runs func() on a worker; the future receives its result or exception
+    template <typename Func>
+    std::future<std::invoke_result_t<Func>> Submit(Func func);
+    std::future<std::vector<Document>> SubmitQuery(const SearchServer &search_server, std::string raw_query);
+
+    // Calls func(i) for every i in [0, count) and returns when all calls are done. The range is split into
+    // chunks that idle workers steal; the calling thread runs chunks too, so nested calls do not deadlock.
+    // The first exception thrown by func is rethrown
+    template <typename Func>
+    void ParallelFor(size_t count, Func func);
+
+    // Shared executor with a worker per hardware thread
+    static QueryExecutor &GetDefault();
+
+private:
+    using Task = std::function<void()>;
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> queued_count_ = 0;
+    std::atomic<size_t> next_queue_ = 0;
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_condition_;
+    bool stopping_ = false;
+
+    void Push(Task task);
+    // Runs one task, looking at the deque of worker first; false if all deques are empty
+    bool TryRunTask(size_t worker);
+    void RunWorker(size_t worker);
+};
+
+template <typename Func>
+std::future<std::invoke_result_t<Func>> QueryExecutor::Submit(Func func)
+{
+    // std::function needs a copyable target
+    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<Func>()>>(std::move(func));
+    auto future = task->get_future();
+    Push([task]
+         { (*task)(); });
+    return future;
+}
+
+template <typename Func>
+void QueryExecutor::ParallelFor(size_t count, Func func)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    // A few chunks per worker let fast workers take over from slow ones
+    const size_t chunk_count = std::min(count, 4 * GetThreadCount());
+    struct State
+    {
+        std::atomic<size_t> remaining;
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr exception;
+    } state;
+    state.remaining = chunk_count;
+    for (size_t chunk = 0; chunk < chunk_count; ++chunk)
+    {
+        Push([&state, &func, first = count * chunk / chunk_count, last = count * (chunk + 1) / chunk_count]
+             {
+                 try
+                 {
+                     for (size_t i = first; i < last; ++i)
+                     {
+                         func(i);
+                     }
+                 }
+                 catch (...)
+                 {
+                     std::lock_guard guard(state.mutex);
+                     if (!state.exception)
+                     {
+                         state.exception = std::current_exception();
+                     }
+                 }
+                 // Decremented under the mutex, so the waiting thread can not destroy state before this unlocks
+                 std::lock_guard guard(state.mutex);
+                 if (--state.remaining == 0)
+                 {
+                     state.done.notify_all();
+                 } });
+    }
+    while (state.remaining > 0 && TryRunTask(GetCurrentWorkerIndex()))
+    {
+    }
+    // Whatever is left is already running on other threads
+    std::unique_lock lock(state.mutex);
+    state.done.wait(lock, [&state]
+                    { return state.remaining == 0; });
+    if (state.exception)
+    {
+        std::rethrow_exception(state.exception);
+    }
+}
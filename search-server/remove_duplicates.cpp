@@ -1,33 +1,187 @@
 #include "remove_duplicates.h"
+#include <algorithm>
+#include <cmath>
+#include <execution>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <utility>
 
-void RemoveDuplicates(SearchServer& search_server) { 
-    // id   
-    std::set<int> remove_doc_id;
-    //  
-    std::map<std::set<std::string>, int> unique_docs;
-    //     
-    for (const int doc_id : search_server) {
-        //  
-        const std::map<std::string, double> doc_words = search_server.GetWordFrequencies(doc_id);
-        // 
-        std::set<std::string> doc_unique_words;
-        //    
-        for (const auto& [word, tf] : doc_words) {
-            doc_unique_words.insert(word);
-        }
-        //            
-        if (unique_docs.count(doc_unique_words)) {
-            // id      
-            remove_doc_id.insert(doc_id);
-        }
-        else {
-            //     
-            unique_docs.insert({ doc_unique_words,doc_id });
-        }
-    }
-    // 
-    for (const int id : remove_doc_id) {
+namespace {
+    uint64_t MixHash(uint64_t value) {
+        // splitmix64 finalizer
+        value += 0x9e3779b97f4a7c15;
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+        return value ^ (value >> 31);
+    }
+
+    uint64_t ComputeFingerprint(const std::vector<TermId>& term_ids) {
+        uint64_t fingerprint = MixHash(term_ids.size());
+        for (const TermId term_id : term_ids) {
+            fingerprint = MixHash(fingerprint ^ term_id);
+        }
+        return fingerprint;
+    }
+
+    std::vector<int> GetDocumentIds(const SearchServer& search_server) {
+        return std::vector<int>(search_server.begin(), search_server.end());
+    }
+
+    std::vector<uint64_t> ComputeMinHashSignature(const std::vector<TermId>& term_ids) {
+        std::vector<uint64_t> signature(MINHASH_SIGNATURE_SIZE, std::numeric_limits<uint64_t>::max());
+        for (const TermId term_id : term_ids) {
+            const uint64_t term_hash = MixHash(term_id);
+            for (size_t i = 0; i < MINHASH_SIGNATURE_SIZE; ++i) {
+                signature[i] = std::min(signature[i], MixHash(term_hash + i));
+            }
+        }
+        return signature;
+    }
+
+    double EstimateSimilarity(const std::vector<uint64_t>& lhs, const std::vector<uint64_t>& rhs) {
+        size_t equal_count = 0;
+        for (size_t i = 0; i < MINHASH_SIGNATURE_SIZE; ++i) {
+            equal_count += lhs[i] == rhs[i];
+        }
+        return static_cast<double>(equal_count) / MINHASH_SIGNATURE_SIZE;
+    }
+
+    // Splits the signature into bands of rows. A pair becomes a candidate when all rows of some band agree,
+    // which happens with probability 1 - (1 - s^rows)^bands for similarity s; the steepest
+    // part of that curve, (1 / bands)^(1 / rows), is put as close to the threshold as possible
+    size_t ChooseBandRowCount(double similarity_threshold) {
+        size_t best_rows = 1;
+        double best_error = std::numeric_limits<double>::max();
+        for (size_t rows = 1; rows <= MINHASH_SIGNATURE_SIZE; ++rows) {
+            const size_t bands = MINHASH_SIGNATURE_SIZE / rows;
+            const double error = std::abs(std::pow(1.0 / bands, 1.0 / rows) - similarity_threshold);
+            if (error < best_error) {
+                best_error = error;
+                best_rows = rows;
+            }
+        }
+        return best_rows;
+    }
+
+    class DisjointSets {
+    public:
+        explicit DisjointSets(size_t size)
+            : parents_(size) {
+            std::iota(parents_.begin(), parents_.end(), 0);
+        }
+
+        size_t Find(size_t element) {
+            while (parents_[element] != element) {
+                parents_[element] = parents_[parents_[element]];
+                element = parents_[element];
+            }
+            return element;
+        }
+
+        // The smaller root wins, so every set is named after its first element
+        void Unite(size_t lhs, size_t rhs) {
+            lhs = Find(lhs);
+            rhs = Find(rhs);
+            parents_[std::max(lhs, rhs)] = std::min(lhs, rhs);
+        }
+
+    private:
+        std::vector<size_t> parents_;
+    };
+}
+
+std::vector<int> FindDuplicates(const SearchServer& search_server) {
+    const std::vector<int> document_ids = GetDocumentIds(search_server);
+    // Fingerprint and id of every document; sorting puts equal word sets next to each other, smallest id first
+    std::vector<std::pair<uint64_t, int>> fingerprints(document_ids.size());
+    std::transform(std::execution::par, document_ids.begin(), document_ids.end(), fingerprints.begin(),
+        [&search_server](int document_id) {
+            return std::pair{ ComputeFingerprint(search_server.GetDocumentTermIds(document_id)), document_id };
+        });
+    std::sort(std::execution::par, fingerprints.begin(), fingerprints.end());
+
+    std::vector<int> duplicate_ids;
+    for (size_t begin = 0; begin < fingerprints.size();) {
+        size_t end = begin + 1;
+        while (end < fingerprints.size() && fingerprints[end].first == fingerprints[begin].first) {
+            ++end;
+        }
+        // Documents with equal fingerprints almost always have equal word sets; the rare collision is ruled out here
+        std::vector<std::vector<TermId>> originals;
+        for (size_t i = begin; i < end && end - begin > 1; ++i) {
+            std::vector<TermId> term_ids = search_server.GetDocumentTermIds(fingerprints[i].second);
+            if (std::find(originals.begin(), originals.end(), term_ids) != originals.end()) {
+                duplicate_ids.push_back(fingerprints[i].second);
+            }
+            else {
+                originals.push_back(std::move(term_ids));
+            }
+        }
+        begin = end;
+    }
+    std::sort(duplicate_ids.begin(), duplicate_ids.end());
+    return duplicate_ids;
+}
+
+void RemoveDuplicates(SearchServer& search_server) {
+    const std::vector<int> duplicate_ids = FindDuplicates(search_server);
+    for (const int id : duplicate_ids) {
         std::cout << std::string("Found duplicate document id ") << id << std::endl;
-        search_server.RemoveDocument(id);
     }
-}
\ No newline at end of file
+    search_server.RemoveDocuments(std::execution::par, duplicate_ids);
+}
+
+std::vector<std::vector<int>> FindNearDuplicates(const SearchServer& search_server, double similarity_threshold) {
+    const std::vector<int> document_ids = GetDocumentIds(search_server);
+    std::vector<std::vector<uint64_t>> signatures(document_ids.size());
+    std::transform(std::execution::par, document_ids.begin(), document_ids.end(), signatures.begin(),
+        [&search_server](int document_id) {
+            return ComputeMinHashSignature(search_server.GetDocumentTermIds(document_id));
+        });
+
+    const size_t rows = ChooseBandRowCount(similarity_threshold);
+    DisjointSets clusters(document_ids.size());
+    // Hash of a band of every document and the document's position; equal hashes form a bucket
+    std::vector<std::pair<uint64_t, size_t>> buckets(document_ids.size());
+    for (size_t band_begin = 0; band_begin + rows <= MINHASH_SIGNATURE_SIZE; band_begin += rows) {
+        for (size_t document = 0; document < document_ids.size(); ++document) {
+            uint64_t band_hash = MixHash(band_begin);
+            for (size_t i = band_begin; i < band_begin + rows; ++i) {
+                band_hash = MixHash(band_hash ^ signatures[document][i]);
+            }
+            buckets[document] = { band_hash, document };
+        }
+        std::sort(std::execution::par, buckets.begin(), buckets.end());
+        // Comparing each member with the first one of its bucket keeps large buckets linear
+        for (size_t begin = 0; begin < buckets.size();) {
+            size_t end = begin + 1;
+            for (; end < buckets.size() && buckets[end].first == buckets[begin].first; ++end) {
+                const size_t first = buckets[begin].second;
+                const size_t other = buckets[end].second;
+                if (EstimateSimilarity(signatures[first], signatures[other]) >= similarity_threshold) {
+                    clusters.Unite(first, other);
+                }
+            }
+            begin = end;
+        }
+    }
+
+    // document_ids are ascending and every root is the first member of its set, so clusters come out sorted
+    std::vector<std::vector<int>> result;
+    std::vector<size_t> cluster_indices(document_ids.size(), std::numeric_limits<size_t>::max());
+    for (size_t document = 0; document < document_ids.size(); ++document) {
+        const size_t root = clusters.Find(document);
+        if (root == document) {
+            continue;
+        }
+        if (cluster_indices[root] == std::numeric_limits<size_t>::max()) {
+            cluster_indices[root] = result.size();
+            result.push_back({ document_ids[root] });
+        }
+        result[cluster_indices[root]].push_back(document_ids[document]);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
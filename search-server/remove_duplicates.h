@@ -1,4 +1,18 @@
 #pragma once
 #include "search_server.h"
+#include <vector>
 
-void RemoveDuplicates(SearchServer& search_server);
\ No newline at end of file
+// Number of MinHash values kept per document by FindNearDuplicates
+const size_t MINHASH_SIGNATURE_SIZE = 128;
+
+// Ids of documents with the same set of words as a document with a smaller id, in ascending order.
+// Documents are compared by a fingerprint of their word set computed in parallel; equal fingerprints are verified
+std::vector<int> FindDuplicates(const SearchServer& search_server);
+
+// Removes the documents returned by FindDuplicates and prints their ids
+void RemoveDuplicates(SearchServer& search_server);
+
+// Groups of documents whose word sets have an estimated Jaccard similarity of at least similarity_threshold.
+// Uses MinHash signatures with locality-sensitive hashing, so a pair near the threshold may be missed.
+// Every cluster is sorted and has at least two documents; clusters are ordered by their first id
+std::vector<std::vector<int>> FindNearDuplicates(const SearchServer& search_server, double similarity_threshold);
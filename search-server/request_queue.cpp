@@ -7,13 +7,13 @@ RequestQueue::RequestQueue(const SearchServer& search_server)
 {
 }
 
-std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentStatus status) {
+std::vector<Document> RequestQueue::AddFindRequest(std::string_view raw_query, DocumentStatus status) {
     const auto& res = search_server_.FindTopDocuments(raw_query, status);
     AddRequest(static_cast<int>(res.size()));
     return res;
 }
 
-std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query) {
+std::vector<Document> RequestQueue::AddFindRequest(std::string_view raw_query) {
     const auto& res = search_server_.FindTopDocuments(raw_query);
     AddRequest(static_cast<int>(res.size()));
     return res;
@@ -9,14 +9,14 @@ public:
     explicit RequestQueue(const SearchServer& search_server);
     // ""    ,      
     template <typename DocumentPredicate>
-    std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate) {
+    std::vector<Document> AddFindRequest(std::string_view raw_query, DocumentPredicate document_predicate) {
         //  
         const auto& res = search_server_.FindTopDocuments(raw_query, document_predicate);
         AddRequest(static_cast<int>(res.size()));
         return res;
     }
-    std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentStatus status);
-    std::vector<Document> AddFindRequest(const std::string& raw_query);
+    std::vector<Document> AddFindRequest(std::string_view raw_query, DocumentStatus status);
+    std::vector<Document> AddFindRequest(std::string_view raw_query);
     int GetNoResultRequests() const;
 private:
     struct QueryResult {
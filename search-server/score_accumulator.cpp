@@ -0,0 +1,25 @@
+#include "score_accumulator.h"
+
+void ScoreAccumulator::Reserve(size_t ordinal_count)
+{
+    if (relevances_.size() < ordinal_count)
+    {
+        relevances_.resize(ordinal_count);
+        touched_bits_.resize((ordinal_count + 63) / 64);
+        excluded_bits_.resize((ordinal_count + 63) / 64);
+    }
+}
+
+void ScoreAccumulator::Clear()
+{
+    for (const DocumentOrdinal ordinal : touched_)
+    {
+        Reset(touched_bits_, ordinal);
+    }
+    for (const DocumentOrdinal ordinal : excluded_)
+    {
+        Reset(excluded_bits_, ordinal);
+    }
+    touched_.clear();
+    excluded_.clear();
+}
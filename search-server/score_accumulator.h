@@ -0,0 +1,92 @@
+#pragma once
+#include "posting_list.h"
+#include <cstdint>
+#include <vector>
+
+// Dense per-query relevance accumulator indexed by document ordinal.
+// Only touched slots are reset after a query, so one instance is reused without reallocation
+class ScoreAccumulator
+{
+public:
+    // Makes room for ordinals [0, ordinal_count); the accumulator must be empty
+    void Reserve(size_t ordinal_count);
+
+    void Add(DocumentOrdinal ordinal, double relevance)
+    {
+        if (!IsSet(touched_bits_, ordinal))
+        {
+            Set(touched_bits_, ordinal);
+            touched_.push_back(ordinal);
+            relevances_[ordinal] = 0.0;
+        }
+        relevances_[ordinal] += relevance;
+    }
+
+    // An excluded document is never reported, even if relevance is added to it afterwards
+    void Exclude(DocumentOrdinal ordinal)
+    {
+        if (!IsSet(excluded_bits_, ordinal))
+        {
+            Set(excluded_bits_, ordinal);
+            excluded_.push_back(ordinal);
+        }
+    }
+
+    bool IsExcluded(DocumentOrdinal ordinal) const
+    {
+        return IsSet(excluded_bits_, ordinal);
+    }
+
+    // Calls func(ordinal, relevance) for every touched and not excluded document
+    template <typename Function>
+    void ForEach(Function func) const
+    {
+        for (const DocumentOrdinal ordinal : touched_)
+        {
+            if (!IsExcluded(ordinal))
+            {
+                func(ordinal, relevances_[ordinal]);
+            }
+        }
+    }
+
+    void Clear();
+
+private:
+    std::vector<double> relevances_;
+    std::vector<uint64_t> touched_bits_;
+    std::vector<uint64_t> excluded_bits_;
+    std::vector<DocumentOrdinal> touched_;
+    std::vector<DocumentOrdinal> excluded_;
+
+    static bool IsSet(const std::vector<uint64_t> &bits, DocumentOrdinal ordinal)
+    {
+        return (bits[ordinal / 64] >> (ordinal % 64)) & 1;
+    }
+    static void Set(std::vector<uint64_t> &bits, DocumentOrdinal ordinal)
+    {
+        bits[ordinal / 64] |= uint64_t{1} << (ordinal % 64);
+    }
+    static void Reset(std::vector<uint64_t> &bits, DocumentOrdinal ordinal)
+    {
+        bits[ordinal / 64] &= ~(uint64_t{1} << (ordinal % 64));
+    }
+};
+
+// Clears the accumulator on leaving the scope, also when a predicate throws, so the next query starts empty
+class ScoreAccumulatorGuard
+{
+public:
+    explicit ScoreAccumulatorGuard(ScoreAccumulator &accumulator)
+        : accumulator_(accumulator) {}
+    ScoreAccumulatorGuard(const ScoreAccumulatorGuard &) = delete;
+    ScoreAccumulatorGuard &operator=(const ScoreAccumulatorGuard &) = delete;
+
+    ~ScoreAccumulatorGuard()
+    {
+        accumulator_.Clear();
+    }
+
+private:
+    ScoreAccumulator &accumulator_;
+};
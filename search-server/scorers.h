@@ -0,0 +1,93 @@
+#pragma once
+#include "posting_list.h"
+#include "term_statistics.h"
+#include <cstddef>
+#include <cstdint>
+
+// Saturation of repeated terms in BM25
+const double BM25_K1 = 1.2;
+// Strength of the document length normalization in BM25, from 0 (none) to 1 (full)
+const double BM25_B = 0.75;
+
+// Totals over the live documents of an index snapshot
+struct CollectionStatistics
+{
+    size_t document_count = 0;
+    double log_document_count = 0.0;
+    double average_document_length = 0.0;
+};
+
+inline double ComputeInverseDocumentFreq(const CollectionStatistics &collection, const TermStatistic &term)
+{
+    return collection.log_document_count - term.log_document_freq;
+}
+
+// Scorers are policy classes. The search loops are instantiated for every scorer, so scoring a posting
+// is an inlined call rather than a virtual one. A scorer is constructed for each query from the
+// CollectionStatistics of its snapshot and provides:
+//   double GetTermWeight(const TermStatistic &term) const - the part of the score that depends only on the term;
+//   double Score(double term_weight, uint32_t term_count, uint32_t document_length) const - the contribution
+//     of a term that occurs term_count times in a document of document_length words;
+//   double GetMaxScore(double term_weight, const PostingList &postings) const - an upper bound of Score
+//     over the posting list, used by MaxScore to skip documents.
+// The relevance of a document is the sum of the contributions of the query's plus words
+
+// Share of the document's words that are the term, times the inverse document frequency
+class TfIdfScorer
+{
+public:
+    explicit TfIdfScorer(const CollectionStatistics &collection)
+        : collection_(collection) {}
+
+    double GetTermWeight(const TermStatistic &term) const
+    {
+        return ComputeInverseDocumentFreq(collection_, term);
+    }
+
+    double Score(double term_weight, uint32_t term_count, uint32_t document_length) const
+    {
+        return term_count / static_cast<double>(document_length) * term_weight;
+    }
+
+    double GetMaxScore(double term_weight, const PostingList &postings) const
+    {
+        return postings.GetMaxTermFreq() * term_weight;
+    }
+
+private:
+    CollectionStatistics collection_;
+};
+
+// Okapi BM25: repeated terms add less and less, and documents longer than average need more occurrences
+// for the same score
+class Bm25Scorer
+{
+public:
+    explicit Bm25Scorer(const CollectionStatistics &collection, double k1 = BM25_K1, double b = BM25_B)
+        : collection_(collection), k1_(k1), length_base_(k1 * (1.0 - b)),
+          length_slope_(collection.average_document_length > 0.0 ? k1 * b / collection.average_document_length : 0.0) {}
+
+    double GetTermWeight(const TermStatistic &term) const
+    {
+        return ComputeInverseDocumentFreq(collection_, term) * (k1_ + 1.0);
+    }
+
+    double Score(double term_weight, uint32_t term_count, uint32_t document_length) const
+    {
+        return term_weight * term_count / (term_count + length_base_ + length_slope_ * document_length);
+    }
+
+    // With term_count = share * document_length, the score only grows when the share grows or the constant
+    // part of the denominator is dropped, and the share is at most the maximum term frequency of the list
+    double GetMaxScore(double term_weight, const PostingList &postings) const
+    {
+        const double max_term_freq = postings.GetMaxTermFreq();
+        return term_weight * max_term_freq / (max_term_freq + length_slope_);
+    }
+
+private:
+    CollectionStatistics collection_;
+    double k1_;
+    double length_base_;
+    double length_slope_;
+};
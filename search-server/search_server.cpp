@@ -1,46 +1,108 @@
 #include "search_server.h"
+#include <cctype>
+#include <charconv>
 #include <cmath>
+#include <thread>
+#include <tuple>
 using namespace std::literals::string_literals;
 
-SearchServer::SearchServer(const std::string &stop_words_text)
-    : SearchServer(SplitIntoWords(stop_words_text)) {}
+SearchServer::SearchServer(const std::string &stop_words_text, const SearchServerOptions &options)
+    : SearchServer(SplitIntoWords(stop_words_text), options) {}
 
 SearchServer::SearchServer() : SearchServer(""s) {}
 
-void SearchServer::AddDocument(int document_id, const std::string &document, DocumentStatus status,
+SearchServer::~SearchServer()
+{
+    {
+        std::lock_guard guard(merge_mutex_);
+        stop_merging_ = true;
+    }
+    merge_condition_.notify_all();
+    merge_thread_.join();
+}
+
+void SearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status,
                                const std::vector<int> &ratings)
 {
-    if ((document_id < 0) || (documents_.count(document_id) > 0))
+    if (document_id < 0)
     {
         throw std::invalid_argument("Invalid document_id"s);
     }
-    const auto words = SplitIntoWordsNoStop(document);
+    std::vector<uint32_t> word_positions;
+    const auto words = SplitIntoWordsNoStop(document, options_.index_positions ? &word_positions : nullptr);
 
-    const double inv_word_count = 1.0 / words.size();
-    for (const auto &word : words)
+    std::lock_guard guard(write_mutex_);
+    const auto snapshot = GetSnapshot();
+    if (FindDocument(*snapshot, document_id))
+    {
+        throw std::invalid_argument("Invalid document_id"s);
+    }
+    std::map<TermId, uint32_t> word_counts;
+    // Positions grouped by term in the order of word_counts
+    std::vector<std::pair<TermId, uint32_t>> term_positions;
+    term_positions.reserve(word_positions.size());
+    for (size_t i = 0; i < words.size(); ++i)
+    {
+        const TermId term_id = terms_.Intern(words[i]);
+        ++word_counts[term_id];
+        if (options_.index_positions)
+        {
+            term_positions.emplace_back(term_id, word_positions[i]);
+        }
+    }
+    SegmentDocument segment_document{
+        {document_id, ComputeAverageRating(ratings), status, static_cast<uint32_t>(words.size())}, {}, {}};
+    segment_document.word_counts.reserve(word_counts.size());
+    for (const auto &[term_id, count] : word_counts)
     {
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        id_document_to_word_freqs_[document_id][word] += inv_word_count;
+        segment_document.word_counts.push_back({term_id, terms_.GetTerm(term_id), count});
     }
-    documents_.emplace(document_id, DocumentData{ComputeAverageRating(ratings), status});
+    std::sort(term_positions.begin(), term_positions.end());
+    segment_document.positions.reserve(term_positions.size());
+    for (const auto &[term_id, position] : term_positions)
+    {
+        segment_document.positions.push_back(position);
+    }
+
+    auto term_statistics = std::make_shared<TermStatistics>(*snapshot->term_statistics);
+    for (const auto &[term_id, count] : word_counts)
+    {
+        term_statistics->AddDocumentFreq(term_id, 1);
+    }
+
+    auto next_snapshot = std::make_shared<IndexSnapshot>(*snapshot);
+    next_snapshot->segments.push_back(
+        {std::make_shared<const IndexSegment>(std::vector<SegmentDocument>{std::move(segment_document)},
+                                              options_.index_positions),
+         nullptr, 0});
+    next_snapshot->term_statistics = std::move(term_statistics);
+    next_snapshot->word_count += words.size();
+    ++next_snapshot->generation;
+    PublishSnapshot(std::move(next_snapshot));
     document_ids_.insert(document_id);
+    RequestMerge();
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(const std::string &raw_query, DocumentStatus status) const
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+                                                     size_t max_count) const
 {
-    return FindTopDocuments(
-        raw_query, [status](int document_id, DocumentStatus document_status, int rating)
-        { return document_status == status; });
+    return FindTopDocumentsByFilter(std::execution::seq, raw_query, DocumentFilter{status, std::nullopt}, max_count);
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(const std::string &raw_query) const
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, const DocumentFilter &filter,
+                                                     size_t max_count) const
+{
+    return FindTopDocumentsByFilter(std::execution::seq, raw_query, filter, max_count);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query) const
 {
     return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
 }
 
 size_t SearchServer::GetDocumentCount() const
 {
-    return documents_.size();
+    return GetSnapshot()->document_count;
 }
 
 std::set<int>::const_iterator SearchServer::begin() const
@@ -55,82 +117,448 @@ std::set<int>::const_iterator SearchServer::end() const
 
 void SearchServer::RemoveDocument(int document_id)
 {
-    if (document_ids_.find(document_id) != document_ids_.end())
+    RemoveDocumentBatch(std::execution::seq, std::vector<int>{document_id});
+}
+
+void SearchServer::RemoveDocument(const std::execution::sequenced_policy &, int document_id)
+{
+    RemoveDocument(document_id);
+}
+
+void SearchServer::RemoveDocument(const std::execution::parallel_policy &, int document_id)
+{
+    RemoveDocument(document_id);
+}
+
+void SearchServer::RemoveDocuments(const std::vector<int> &document_ids)
+{
+    RemoveDocumentBatch(std::execution::seq, document_ids);
+}
+
+void SearchServer::RemoveDocuments(const std::execution::sequenced_policy &, const std::vector<int> &document_ids)
+{
+    RemoveDocumentBatch(std::execution::seq, document_ids);
+}
+
+void SearchServer::RemoveDocuments(const std::execution::parallel_policy &, const std::vector<int> &document_ids)
+{
+    RemoveDocumentBatch(std::execution::par, document_ids);
+}
+
+template <typename ExecutionPolicy>
+void SearchServer::RemoveDocumentBatch(const ExecutionPolicy &policy, const std::vector<int> &document_ids)
+{
+    std::lock_guard guard(write_mutex_);
+    const auto snapshot = GetSnapshot();
+    std::vector<std::optional<DocumentLocation>> locations(document_ids.size());
+    std::transform(policy, document_ids.begin(), document_ids.end(), locations.begin(), [&snapshot](int document_id)
+                   { return FindDocument(*snapshot, document_id); });
+    // Ordinals to delete in every segment
+    std::vector<std::vector<DocumentOrdinal>> segment_ordinals(snapshot->segments.size());
+    std::vector<size_t> changed_segments;
+    for (const auto &location : locations)
     {
-        for (const auto &[word, tf] : id_document_to_word_freqs_[document_id])
+        if (location)
         {
-            const auto iterator_erase = word_to_document_freqs_[word].find(document_id);
-            word_to_document_freqs_[word].erase(iterator_erase);
+            if (segment_ordinals[location->segment].empty())
+            {
+                changed_segments.push_back(location->segment);
+            }
+            segment_ordinals[location->segment].push_back(location->ordinal);
         }
     }
+    if (changed_segments.empty())
+    {
+        return;
+    }
+    // An id passed twice must be subtracted from the term statistics once
+    for (const size_t segment_index : changed_segments)
+    {
+        std::vector<DocumentOrdinal> &ordinals = segment_ordinals[segment_index];
+        std::sort(ordinals.begin(), ordinals.end());
+        ordinals.erase(std::unique(ordinals.begin(), ordinals.end()), ordinals.end());
+    }
 
-    documents_.erase(document_id);
-    document_ids_.erase(document_id);
-    id_document_to_word_freqs_.erase(document_id);
+    auto next_snapshot = std::make_shared<IndexSnapshot>(*snapshot);
+    std::for_each(policy, changed_segments.begin(), changed_segments.end(),
+                  [&next_snapshot, &segment_ordinals](size_t segment_index)
+                  {
+                      auto &segment = next_snapshot->segments[segment_index];
+                      const IndexSegment &index = *segment.index;
+                      const std::vector<DocumentOrdinal> &ordinals = segment_ordinals[segment_index];
+                      auto deletions = CopyDeletions(segment);
+                      // Recounting every posting list is cheaper than walking the forward index
+                      // of each removed document once each thread gets less work than the batch
+                      const bool recount = std::is_same_v<ExecutionPolicy, std::execution::parallel_policy> &&
+                                           ordinals.size() * std::max(1u, std::thread::hardware_concurrency()) >
+                                               index.GetOrdinalCount();
+                      for (const DocumentOrdinal ordinal : ordinals)
+                      {
+                          if (deletions->is_deleted[ordinal])
+                          {
+                              continue;
+                          }
+                          if (recount)
+                          {
+                              deletions->is_deleted[ordinal] = true;
+                              ++deletions->deleted_count;
+                          }
+                          else
+                          {
+                              MarkDeleted(index, *deletions, ordinal);
+                          }
+                      }
+                      if (recount)
+                      {
+                          CountDeletedPostings(index, *deletions);
+                      }
+                      segment.deletions = std::move(deletions);
+                  });
+    auto term_statistics = std::make_shared<TermStatistics>(*snapshot->term_statistics);
+    for (const size_t segment_index : changed_segments)
+    {
+        const IndexSegment &index = *snapshot->segments[segment_index].index;
+        for (const DocumentOrdinal ordinal : segment_ordinals[segment_index])
+        {
+            next_snapshot->word_count -= index.GetDocument(ordinal).word_count;
+            index.ForEachWordCount(ordinal, [&index, &term_statistics](uint32_t term, uint32_t)
+                                   { term_statistics->AddDocumentFreq(index.GetTermId(term), -1); });
+        }
+    }
+    next_snapshot->term_statistics = std::move(term_statistics);
+    ++next_snapshot->generation;
+    PublishSnapshot(std::move(next_snapshot));
+    for (const auto &location : locations)
+    {
+        if (location)
+        {
+            document_ids_.erase(snapshot->segments[location->segment].index->GetDocument(location->ordinal).id);
+        }
+    }
+    // Segments left with many removed documents are rewritten without them, which also drops their empty terms
+    RequestMerge();
+}
+
+void SearchServer::WaitForMerges()
+{
+    std::unique_lock lock(merge_mutex_);
+    merge_condition_.wait(lock, [this]
+                          { return !merge_requested_ && !merging_; });
 }
 
-const std::map<std::string, double> &SearchServer::GetWordFrequencies(int document_id) const
+void SearchServer::SaveIndex(const std::string &path) const
 {
-    static std::map<std::string, double> empty;
-    return id_document_to_word_freqs_.count(document_id) ? id_document_to_word_freqs_.at(document_id) : empty;
+    const auto snapshot = GetSnapshot();
+    if (snapshot->segments.size() == 1 && !snapshot->segments.front().deletions)
+    {
+        WriteIndexFile(path, stop_words_, *snapshot->segments.front().index);
+        return;
+    }
+    WriteIndexFile(path, stop_words_, *MergeSegments(snapshot->segments, options_.index_positions));
+}
+
+std::unique_ptr<SearchServer> SearchServer::OpenIndex(const std::string &path)
+{
+    IndexFile file = ReadIndexFile(path);
+    auto server = std::make_unique<SearchServer>(file.stop_words,
+                                                 SearchServerOptions{file.arrays.position_offsets != nullptr});
+    std::lock_guard guard(server->write_mutex_);
+    std::vector<TermId> term_ids;
+    std::vector<std::string_view> term_words;
+    term_ids.reserve(file.terms.size());
+    term_words.reserve(file.terms.size());
+    for (const std::string_view term : file.terms)
+    {
+        term_ids.push_back(server->terms_.Intern(term));
+        term_words.push_back(server->terms_.GetTerm(term_ids.back()));
+    }
+    auto segment = std::make_shared<const IndexSegment>(file.arrays, std::move(term_ids), std::move(term_words),
+                                                        std::move(file.mapping));
+    uint64_t word_count = 0;
+    for (DocumentOrdinal ordinal = 0; ordinal < segment->GetOrdinalCount(); ++ordinal)
+    {
+        server->document_ids_.insert(segment->GetDocument(ordinal).id);
+        word_count += segment->GetDocument(ordinal).word_count;
+    }
+    auto term_statistics = std::make_shared<TermStatistics>();
+    for (uint32_t term = 0; term < segment->GetTermCount(); ++term)
+    {
+        term_statistics->AddDocumentFreq(segment->GetTermId(term), segment->GetPostings(term).size());
+    }
+    auto snapshot = std::make_shared<IndexSnapshot>();
+    snapshot->term_statistics = std::move(term_statistics);
+    snapshot->word_count = word_count;
+    if (segment->GetOrdinalCount() > 0)
+    {
+        snapshot->segments.push_back({std::move(segment), nullptr, 0});
+    }
+    server->PublishSnapshot(std::move(snapshot));
+    return server;
 }
 
-std::tuple<std::vector<std::string>, DocumentStatus> SearchServer::MatchDocument(const std::string &raw_query,
+void SearchServer::SetRetrievalMode(RetrievalMode mode)
+{
+    retrieval_mode_ = mode;
+}
+
+RetrievalMode SearchServer::GetRetrievalMode() const
+{
+    return retrieval_mode_;
+}
+
+void SearchServer::SetRankingFunction(RankingFunction ranking_function)
+{
+    ranking_function_ = ranking_function;
+}
+
+RankingFunction SearchServer::GetRankingFunction() const
+{
+    return ranking_function_;
+}
+
+const SearchServerOptions &SearchServer::GetOptions() const
+{
+    return options_;
+}
+
+void SearchServer::SetQueryCacheCapacity(size_t capacity)
+{
+    std::atomic_store(&query_cache_, capacity > 0 ? std::make_shared<QueryCache>(capacity) : nullptr);
+}
+
+QueryCacheStats SearchServer::GetQueryCacheStats() const
+{
+    const auto query_cache = std::atomic_load(&query_cache_);
+    return query_cache ? query_cache->GetStats() : QueryCacheStats{};
+}
+
+std::map<std::string_view, double> SearchServer::GetWordFrequencies(int document_id) const
+{
+    const auto snapshot = GetSnapshot();
+    std::map<std::string_view, double> word_freqs;
+    if (const auto location = FindDocument(*snapshot, document_id))
+    {
+        const IndexSegment &index = *snapshot->segments[location->segment].index;
+        index.ForEachWordCount(location->ordinal, [&index, &word_freqs, ordinal = location->ordinal](uint32_t term, uint32_t count)
+                               { word_freqs.emplace(index.GetTermWord(term), index.ComputeTermFreq(ordinal, count)); });
+    }
+    return word_freqs;
+}
+
+std::vector<TermId> SearchServer::GetDocumentTermIds(int document_id) const
+{
+    const auto snapshot = GetSnapshot();
+    std::vector<TermId> term_ids;
+    if (const auto location = FindDocument(*snapshot, document_id))
+    {
+        const IndexSegment &index = *snapshot->segments[location->segment].index;
+        index.ForEachWordCount(location->ordinal, [&index, &term_ids](uint32_t term, uint32_t)
+                               { term_ids.push_back(index.GetTermId(term)); });
+        std::sort(term_ids.begin(), term_ids.end());
+    }
+    return term_ids;
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::string_view raw_query,
                                                                                  int document_id) const
 {
-    const auto query = ParseQuery(raw_query);
+    METRICS_TIME_STAGE(MetricStage::MATCH);
+    const auto snapshot = GetSnapshot();
+    const auto query = ParseQuery(*snapshot, raw_query);
+    const auto location = FindDocument(*snapshot, document_id);
+    if (!location)
+    {
+        throw std::out_of_range("Invalid document_id"s);
+    }
+    const IndexSegment &index = *snapshot->segments[location->segment].index;
+    const DocumentStatus status = index.GetDocument(location->ordinal).status;
 
-    std::vector<std::string> matched_words;
-    for (const std::string &word : query.plus_words)
+    std::vector<std::string_view> matched_words;
+    for (const std::string_view word : query.minus_words)
     {
-        if (word_to_document_freqs_.count(word) == 0)
+        if (!FindDocumentWord(index, location->ordinal, word).empty())
         {
-            continue;
+            return {matched_words, status};
         }
-        if (word_to_document_freqs_.at(word).count(document_id))
+    }
+    std::vector<uint32_t> constraint_terms;
+    if (!query.constraints.empty() && (!FindConstraintTerms(index, query, constraint_terms) ||
+                                       !MatchesConstraints(index, location->ordinal, query, constraint_terms)))
+    {
+        return {matched_words, status};
+    }
+    for (const std::string_view word : query.plus_words)
+    {
+        if (const std::string_view term_word = FindDocumentWord(index, location->ordinal, word); !term_word.empty())
         {
-            matched_words.push_back(word);
+            matched_words.push_back(term_word);
         }
     }
-    for (const std::string &word : query.minus_words)
+    return {matched_words, status};
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::sequenced_policy &,
+                                                                                 std::string_view raw_query,
+                                                                                 int document_id) const
+{
+    return MatchDocument(raw_query, document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::parallel_policy &,
+                                                                                 std::string_view raw_query,
+                                                                                 int document_id) const
+{
+    METRICS_TIME_STAGE(MetricStage::MATCH);
+    const auto snapshot = GetSnapshot();
+    // Duplicates are dropped from the matched words only, which are usually far fewer than the query words
+    const auto query = ParseQuery(*snapshot, raw_query, false);
+    const auto location = FindDocument(*snapshot, document_id);
+    if (!location)
+    {
+        throw std::out_of_range("Invalid document_id"s);
+    }
+    const IndexSegment &index = *snapshot->segments[location->segment].index;
+    const auto find_word = [&index, ordinal = location->ordinal](std::string_view word)
+    {
+        return FindDocumentWord(index, ordinal, word);
+    };
+    const DocumentStatus status = index.GetDocument(location->ordinal).status;
+
+    std::vector<std::string_view> matched_words;
+    if (std::any_of(std::execution::par, query.minus_words.begin(), query.minus_words.end(),
+                    [&find_word](std::string_view word)
+                    { return !find_word(word).empty(); }))
+    {
+        return {matched_words, status};
+    }
+    std::vector<uint32_t> constraint_terms;
+    if (!query.constraints.empty() && (!FindConstraintTerms(index, query, constraint_terms) ||
+                                       !MatchesConstraints(index, location->ordinal, query, constraint_terms)))
+    {
+        return {matched_words, status};
+    }
+    // Words that do not match become empty views and are dropped afterwards
+    matched_words.resize(query.plus_words.size());
+    std::transform(std::execution::par, query.plus_words.begin(), query.plus_words.end(), matched_words.begin(), find_word);
+    std::sort(std::execution::par, matched_words.begin(), matched_words.end());
+    matched_words.erase(std::unique(matched_words.begin(), matched_words.end()), matched_words.end());
+    if (!matched_words.empty() && matched_words.front().empty())
+    {
+        matched_words.erase(matched_words.begin());
+    }
+    return {matched_words, status};
+}
+
+bool SearchServer::FindConstraintTerms(const IndexSegment &index, const Query &query, std::vector<uint32_t> &terms)
+{
+    terms.clear();
+    if (!index.HasPositions())
     {
-        if (word_to_document_freqs_.count(word) == 0)
+        return false;
+    }
+    for (const PositionConstraint &constraint : query.constraints)
+    {
+        for (const auto &[word, offset] : constraint.words)
         {
-            continue;
+            const auto term = index.FindTerm(word);
+            if (!term)
+            {
+                return false;
+            }
+            terms.push_back(*term);
+        }
+    }
+    return true;
+}
+
+bool SearchServer::MatchesConstraints(const IndexSegment &index, DocumentOrdinal ordinal, const Query &query,
+                                      const std::vector<uint32_t> &terms)
+{
+    // Reused by every document checked on the calling thread
+    static thread_local std::vector<uint32_t> starts;
+    static thread_local std::vector<uint32_t> positions;
+    auto term = terms.begin();
+    for (const PositionConstraint &constraint : query.constraints)
+    {
+        if (!index.GetPositions(ordinal, *term++, starts))
+        {
+            return false;
         }
-        if (word_to_document_freqs_.at(word).count(document_id))
+        for (auto word = constraint.words.begin() + 1; word != constraint.words.end(); ++word)
         {
-            matched_words.clear();
-            break;
+            if (!index.GetPositions(ordinal, *term++, positions))
+            {
+                return false;
+            }
+            if (constraint.max_distance)
+            {
+                // The closest pair is among neighbours in the merged order of the two lists
+                auto first = starts.begin();
+                auto second = positions.begin();
+                while (first != starts.end() && second != positions.end() &&
+                       std::max(*first, *second) - std::min(*first, *second) > *constraint.max_distance)
+                {
+                    *first < *second ? ++first : ++second;
+                }
+                if (first == starts.end() || second == positions.end())
+                {
+                    return false;
+                }
+                continue;
+            }
+            // Keeps the starts from which the word occurs at its offset
+            const uint32_t offset = word->second;
+            auto position = positions.begin();
+            size_t kept_count = 0;
+            for (size_t i = 0; i < starts.size(); ++i)
+            {
+                position = std::lower_bound(position, positions.end(), starts[i] + offset);
+                if (position != positions.end() && *position == starts[i] + offset)
+                {
+                    starts[kept_count++] = starts[i];
+                }
+            }
+            starts.resize(kept_count);
+            if (starts.empty())
+            {
+                return false;
+            }
         }
     }
-    return {matched_words, documents_.at(document_id).status};
+    return true;
 }
 
-bool SearchServer::IsStopWord(const std::string &word) const
+std::string_view SearchServer::FindDocumentWord(const IndexSegment &index, DocumentOrdinal ordinal, std::string_view word)
+{
+    const auto term = index.FindTerm(word);
+    return term && index.HasTerm(ordinal, *term) ? index.GetTermWord(*term) : std::string_view();
+}
+
+bool SearchServer::IsStopWord(std::string_view word) const
 {
     return stop_words_.count(word) > 0;
 }
 
-bool SearchServer::IsValidWord(const std::string &word)
+bool SearchServer::IsValidWord(std::string_view word)
 {
     // A valid word must not contain special characters
-    return none_of(word.begin(), word.end(), [](char c)
+    return std::none_of(word.begin(), word.end(), [](char c)
                    { return c >= '\0' && c < ' '; });
 }
 
-std::vector<std::string> SearchServer::SplitIntoWordsNoStop(const std::string &text) const
+std::vector<std::string_view> SearchServer::SplitIntoWordsNoStop(std::string_view text, std::vector<uint32_t> *positions) const
 {
-    std::vector<std::string> words;
-    for (const auto &word : SplitIntoWords(text))
+    std::vector<std::string_view> words;
+    const auto tokens = SplitIntoWords(text);
+    for (size_t i = 0; i < tokens.size(); ++i)
     {
-        if (!IsValidWord(word))
+        if (!IsStopWord(tokens[i]))
         {
-            throw std::invalid_argument("Word "s + word + " is invalid"s);
-        }
-        if (!IsStopWord(word))
-        {
-            words.push_back(word);
+            words.push_back(tokens[i]);
+            if (positions)
+            {
+                positions->push_back(static_cast<uint32_t>(i));
+            }
         }
     }
     return words;
@@ -150,49 +578,619 @@ int SearchServer::ComputeAverageRating(const std::vector<int> &ratings)
     return rating_sum / static_cast<int>(ratings.size());
 }
 
-SearchServer::QueryWord SearchServer::ParseQueryWord(const std::string &text) const
+SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view text) const
 {
     if (text.empty())
     {
         throw std::invalid_argument("Query word is empty"s);
     }
-    std::string word = text;
+    std::string_view word = text;
     bool is_minus = false;
     if (word[0] == '-')
     {
         is_minus = true;
-        word = word.substr(1);
+        word.remove_prefix(1);
+    }
+    bool is_prefix = false;
+    uint32_t max_edit_distance = 0;
+    // A '~' followed by anything but one digit is an ordinary character
+    const size_t tilde = word.rfind('~');
+    if (!word.empty() && word.back() == '*')
+    {
+        is_prefix = true;
+        word.remove_suffix(1);
     }
-    if (word.empty() || word[0] == '-' || !IsValidWord(word))
+    else if (tilde != std::string_view::npos && (tilde + 1 == word.size() ||
+                                                 (tilde + 2 == word.size() && std::isdigit(static_cast<unsigned char>(word.back())))))
     {
-        throw std::invalid_argument("Query word "s + text + " is invalid"s);
+        max_edit_distance = tilde + 1 == word.size() ? 1 : static_cast<uint32_t>(word.back() - '0');
+        if (max_edit_distance < 1 || max_edit_distance > MAX_FUZZY_EDIT_DISTANCE)
+        {
+            throw std::invalid_argument("Query word "s + std::string(text) + " has an invalid edit distance"s);
+        }
+        word.remove_suffix(word.size() - tilde);
+    }
+    // SplitIntoWords has already rejected control characters
+    if (word.empty() || word[0] == '-')
+    {
+        throw std::invalid_argument("Query word "s + std::string(text) + " is invalid"s);
     }
 
-    return {word, is_minus, IsStopWord(word)};
+    // Expansions come from the index, which has no stop words
+    const bool is_stop = !is_prefix && max_edit_distance == 0 && IsStopWord(word);
+    return {word, is_minus, is_stop, is_prefix, max_edit_distance};
 }
 
-SearchServer::Query SearchServer::ParseQuery(const std::string &text) const
+std::optional<uint32_t> SearchServer::ParseNearOperator(std::string_view token)
 {
+    const std::string_view prefix = "NEAR/";
+    if (token.substr(0, prefix.size()) != prefix)
+    {
+        return std::nullopt;
+    }
+    uint32_t max_distance = 0;
+    const char *last = token.data() + token.size();
+    const auto [end, error] = std::from_chars(token.data() + prefix.size(), last, max_distance);
+    if (error != std::errc() || end != last)
+    {
+        throw std::invalid_argument("Invalid distance in "s + std::string(token));
+    }
+    return max_distance;
+}
+
+SearchServer::Query SearchServer::ParseQuery(const IndexSnapshot &snapshot, std::string_view text, bool deduplicate) const
+{
+    METRICS_TIME_STAGE(MetricStage::PARSE);
     Query result;
-    for (const auto &word : SplitIntoWords(text))
+    // Plus words are compacted in place within the token buffer, which is sized by the spaces in one allocation
+    result.plus_words.reserve(std::count(text.begin(), text.end(), ' ') + 1);
+    SplitIntoWords(text, result.plus_words);
+    size_t plus_word_count = 0;
+    bool is_in_phrase = false;
+    // Token index of the first word kept in the open phrase; offsets count from it, since the matching starts
+    // from its positions, so stop words before it place nothing
+    size_t phrase_start = 0;
+    PositionConstraint phrase;
+    // Set after a plus word outside phrases, which may be the left side of a NEAR; empty for a stop word
+    std::optional<std::string_view> near_left;
+    std::optional<uint32_t> near_distance;
+    // Prefix and fuzzy words, expanded once the plus words are compacted
+    std::vector<QueryWord> expanded_words;
+    for (size_t i = 0; i < result.plus_words.size(); ++i)
     {
-        const auto query_word = ParseQueryWord(word);
-        if (!query_word.is_stop)
+        std::string_view token = result.plus_words[i];
+        if (const auto max_distance = ParseNearOperator(token))
+        {
+            if (!near_left)
+            {
+                throw std::invalid_argument("NEAR must stand between two words"s);
+            }
+            near_distance = max_distance;
+            near_left.reset();
+            continue;
+        }
+        bool closes_phrase = false;
+        if (token[0] == '"' && !(is_in_phrase && token.size() == 1))
+        {
+            if (is_in_phrase)
+            {
+                throw std::invalid_argument("Phrases can not be nested"s);
+            }
+            is_in_phrase = true;
+            token.remove_prefix(1);
+        }
+        if (!token.empty() && token.back() == '"')
+        {
+            if (!is_in_phrase)
+            {
+                throw std::invalid_argument("Phrase is not opened"s);
+            }
+            closes_phrase = true;
+            token.remove_suffix(1);
+        }
+        std::optional<QueryWord> query_word;
+        if (!token.empty())
         {
-            if (query_word.is_minus)
+            query_word = ParseQueryWord(token);
+            if (query_word->is_minus && is_in_phrase)
             {
-                result.minus_words.insert(query_word.data);
+                throw std::invalid_argument("Phrases can not contain minus words"s);
+            }
+            if ((query_word->is_prefix || query_word->max_edit_distance > 0) && (is_in_phrase || near_distance))
+            {
+                throw std::invalid_argument("Phrases and NEAR can not contain prefix or fuzzy words"s);
+            }
+        }
+        if (near_distance)
+        {
+            if (!query_word || query_word->is_minus || is_in_phrase)
+            {
+                throw std::invalid_argument("NEAR must stand between two words"s);
+            }
+            // A stop word matches anything, so the constraint is dropped
+            if (!near_left->empty() && !query_word->is_stop)
+            {
+                result.constraints.push_back({{{*near_left, 0}, {query_word->data, 0}}, near_distance});
+            }
+            near_distance.reset();
+        }
+        near_left.reset();
+        if (query_word && (query_word->is_prefix || query_word->max_edit_distance > 0))
+        {
+            expanded_words.push_back(*query_word);
+            continue;
+        }
+        if (query_word && !query_word->is_minus && !is_in_phrase)
+        {
+            near_left = query_word->is_stop ? std::string_view() : query_word->data;
+        }
+        if (query_word && !query_word->is_stop)
+        {
+            if (query_word->is_minus)
+            {
+                result.minus_words.push_back(query_word->data);
             }
             else
             {
-                result.plus_words.insert(query_word.data);
+                result.plus_words[plus_word_count++] = query_word->data;
+                if (is_in_phrase)
+                {
+                    if (phrase.words.empty())
+                    {
+                        phrase_start = i;
+                    }
+                    phrase.words.emplace_back(query_word->data, static_cast<uint32_t>(i - phrase_start));
+                }
             }
         }
+        if (closes_phrase)
+        {
+            // Stop words only keep their place, so a phrase with fewer than two other words matches anywhere
+            if (phrase.words.size() > 1)
+            {
+                result.constraints.push_back(std::move(phrase));
+            }
+            phrase = {};
+            is_in_phrase = false;
+        }
+    }
+    if (is_in_phrase || near_distance)
+    {
+        throw std::invalid_argument("Query ends inside a phrase or NEAR"s);
+    }
+    if (!result.constraints.empty() && !options_.index_positions)
+    {
+        throw std::invalid_argument("Phrase and NEAR queries need an index with positions"s);
+    }
+    result.plus_words.resize(plus_word_count);
+    for (const QueryWord &word : expanded_words)
+    {
+        ExpandQueryWord(snapshot, word, result);
+    }
+    if (!deduplicate)
+    {
+        return result;
+    }
+    const auto sort_unique = [](std::vector<std::string_view> &words)
+    {
+        std::sort(words.begin(), words.end());
+        words.erase(std::unique(words.begin(), words.end()), words.end());
+    };
+    sort_unique(result.minus_words);
+    if (result.plus_word_boosts.empty())
+    {
+        sort_unique(result.plus_words);
+    }
+    else
+    {
+        // A word that is both typed and expanded, or expanded twice, keeps its largest boost
+        std::vector<std::pair<std::string_view, double>> boosted_words;
+        boosted_words.reserve(result.plus_words.size());
+        for (size_t i = 0; i < result.plus_words.size(); ++i)
+        {
+            boosted_words.emplace_back(result.plus_words[i], -result.plus_word_boosts[i]);
+        }
+        std::sort(boosted_words.begin(), boosted_words.end());
+        boosted_words.erase(std::unique(boosted_words.begin(), boosted_words.end(),
+                                        [](const auto &lhs, const auto &rhs)
+                                        { return lhs.first == rhs.first; }),
+                            boosted_words.end());
+        result.plus_words.clear();
+        result.plus_word_boosts.clear();
+        for (const auto &[word, negative_boost] : boosted_words)
+        {
+            result.plus_words.push_back(word);
+            result.plus_word_boosts.push_back(-negative_boost);
+        }
     }
     return result;
 }
 
-double SearchServer::ComputeWordInverseDocumentFreq(const std::string &word) const
+void SearchServer::ExpandQueryWord(const IndexSnapshot &snapshot, const QueryWord &word, Query &query)
+{
+    struct Expansion
+    {
+        TermId term_id;
+        std::string_view word;
+        uint32_t distance;
+        uint32_t document_freq;
+    };
+    std::vector<Expansion> expansions;
+    for (const auto &segment : snapshot.segments)
+    {
+        const IndexSegment &index = *segment.index;
+        const auto add = [&index, &expansions](uint32_t term, uint32_t distance)
+        {
+            expansions.push_back({index.GetTermId(term), index.GetTermWord(term), distance, 0});
+        };
+        if (word.is_prefix)
+        {
+            index.GetTermTrie().ForEachWithPrefix(word.data, [&add](uint32_t term)
+                                                  { add(term, 0); });
+        }
+        else
+        {
+            index.GetTermTrie().ForEachWithinDistance(word.data, word.max_edit_distance, add);
+        }
+    }
+    // Segments share terms; the ones whose documents are all removed are dropped
+    std::sort(expansions.begin(), expansions.end(), [](const Expansion &lhs, const Expansion &rhs)
+              { return lhs.term_id < rhs.term_id; });
+    expansions.erase(std::unique(expansions.begin(), expansions.end(), [](const Expansion &lhs, const Expansion &rhs)
+                                 { return lhs.term_id == rhs.term_id; }),
+                     expansions.end());
+    // An exclusion must cover every word, so minus words are not capped
+    if (word.is_minus)
+    {
+        for (const Expansion &expansion : expansions)
+        {
+            query.minus_words.push_back(expansion.word);
+        }
+        return;
+    }
+    for (Expansion &expansion : expansions)
+    {
+        expansion.document_freq = snapshot.term_statistics->Get(expansion.term_id).document_freq;
+    }
+    expansions.erase(std::remove_if(expansions.begin(), expansions.end(), [](const Expansion &expansion)
+                                    { return expansion.document_freq == 0; }),
+                     expansions.end());
+    // The closest words first, then the most frequent, which are the likeliest intended ones
+    const size_t expansion_count = std::min(expansions.size(), MAX_TERM_EXPANSIONS);
+    std::partial_sort(expansions.begin(), expansions.begin() + expansion_count, expansions.end(),
+                      [](const Expansion &lhs, const Expansion &rhs)
+                      {
+                          return std::tie(lhs.distance, rhs.document_freq, lhs.word) <
+                                 std::tie(rhs.distance, lhs.document_freq, rhs.word);
+                      });
+    expansions.resize(expansion_count);
+
+    query.plus_word_boosts.resize(query.plus_words.size(), 1.0);
+    for (const Expansion &expansion : expansions)
+    {
+        query.plus_words.push_back(expansion.word);
+        query.plus_word_boosts.push_back(1.0 / (1 + expansion.distance));
+    }
+}
+
+std::shared_ptr<const SearchServer::IndexSnapshot> SearchServer::GetSnapshot() const
+{
+    return std::atomic_load(&snapshot_);
+}
+
+void SearchServer::PublishSnapshot(std::shared_ptr<IndexSnapshot> snapshot)
+{
+    UpdateSnapshotTotals(*snapshot);
+    std::atomic_store(&snapshot_, std::shared_ptr<const IndexSnapshot>(std::move(snapshot)));
+}
+
+void SearchServer::UpdateSnapshotTotals(IndexSnapshot &snapshot)
+{
+    snapshot.ordinal_count = 0;
+    snapshot.document_count = 0;
+    for (auto &segment : snapshot.segments)
+    {
+        segment.first_ordinal = snapshot.ordinal_count;
+        snapshot.ordinal_count += static_cast<DocumentOrdinal>(segment.index->GetOrdinalCount());
+        snapshot.document_count += GetLiveDocumentCount(segment);
+    }
+    CollectionStatistics &collection = snapshot.collection_statistics;
+    collection.document_count = snapshot.document_count;
+    collection.log_document_count = snapshot.document_count > 0 ? std::log(snapshot.document_count) : 0.0;
+    collection.average_document_length =
+        snapshot.document_count > 0 ? snapshot.word_count / static_cast<double>(snapshot.document_count) : 0.0;
+}
+
+std::optional<SearchServer::DocumentLocation> SearchServer::FindDocument(const IndexSnapshot &snapshot, int document_id)
+{
+    // A removed id may be added again, so only a live copy counts
+    for (size_t segment = snapshot.segments.size(); segment-- > 0;)
+    {
+        const auto ordinal = snapshot.segments[segment].index->FindOrdinal(document_id);
+        if (ordinal && !IsDeleted(snapshot.segments[segment], *ordinal))
+        {
+            return DocumentLocation{segment, *ordinal};
+        }
+    }
+    return std::nullopt;
+}
+
+bool SearchServer::IsDeleted(const IndexSnapshot::Segment &segment, DocumentOrdinal ordinal)
+{
+    return segment.deletions && segment.deletions->is_deleted[ordinal];
+}
+
+size_t SearchServer::GetLiveDocumentCount(const IndexSnapshot::Segment &segment)
+{
+    const size_t deleted_count = segment.deletions ? segment.deletions->deleted_count : 0;
+    return segment.index->GetOrdinalCount() - deleted_count;
+}
+
+std::shared_ptr<SegmentDeletions> SearchServer::CopyDeletions(const IndexSnapshot::Segment &segment)
+{
+    if (segment.deletions)
+    {
+        return std::make_shared<SegmentDeletions>(*segment.deletions);
+    }
+    const IndexSegment &index = *segment.index;
+    return std::make_shared<SegmentDeletions>(SegmentDeletions{
+        std::vector<bool>(index.GetOrdinalCount()), std::vector<uint32_t>(index.GetTermCount()), 0});
+}
+
+void SearchServer::CountDeletedPostings(const IndexSegment &index, SegmentDeletions &deletions)
+{
+    std::vector<uint32_t> terms(index.GetTermCount());
+    std::iota(terms.begin(), terms.end(), 0);
+    std::for_each(std::execution::par, terms.begin(), terms.end(), [&index, &deletions](uint32_t term)
+                  {
+                      uint32_t deleted_document_freq = 0;
+                      index.GetPostings(term).ForEachPosting(0, static_cast<DocumentOrdinal>(index.GetOrdinalCount()),
+                                                             [&deletions, &deleted_document_freq](DocumentOrdinal ordinal, uint32_t)
+                                                             { deleted_document_freq += deletions.is_deleted[ordinal]; });
+                      deletions.deleted_document_freqs[term] = deleted_document_freq;
+                  });
+}
+
+void SearchServer::MarkDeleted(const IndexSegment &index, SegmentDeletions &deletions, DocumentOrdinal ordinal)
+{
+    deletions.is_deleted[ordinal] = true;
+    ++deletions.deleted_count;
+    index.ForEachWordCount(ordinal, [&deletions](uint32_t term, uint32_t)
+                           { ++deletions.deleted_document_freqs[term]; });
+}
+
+void SearchServer::RequestMerge()
+{
+    {
+        std::lock_guard guard(merge_mutex_);
+        merge_requested_ = true;
+    }
+    merge_condition_.notify_all();
+}
+
+void SearchServer::RunMerges()
+{
+    std::unique_lock lock(merge_mutex_);
+    while (true)
+    {
+        merge_condition_.wait(lock, [this]
+                              { return stop_merging_ || merge_requested_; });
+        if (stop_merging_)
+        {
+            return;
+        }
+        merge_requested_ = false;
+        merging_ = true;
+        lock.unlock();
+        while (MergeOnce())
+        {
+        }
+        lock.lock();
+        merging_ = false;
+        merge_condition_.notify_all();
+    }
+}
+
+bool SearchServer::MergeOnce()
+{
+    const auto sources = SelectMerge(*GetSnapshot());
+    if (sources.empty())
+    {
+        return false;
+    }
+    // The expensive part runs without blocking writers
+    auto merged = MergeSegments(sources, options_.index_positions);
+
+    std::lock_guard guard(write_mutex_);
+    const auto snapshot = GetSnapshot();
+    auto next_snapshot = std::make_shared<IndexSnapshot>();
+    // Merging only drops documents that are already subtracted from the term statistics
+    next_snapshot->term_statistics = snapshot->term_statistics;
+    next_snapshot->word_count = snapshot->word_count;
+    next_snapshot->generation = snapshot->generation;
+    std::shared_ptr<SegmentDeletions> deletions;
+    size_t merged_position = 0;
+    // Writers only append segments and replace tombstones, so every source is still in the snapshot
+    for (const auto &segment : snapshot->segments)
+    {
+        const auto source = std::find_if(sources.begin(), sources.end(), [&segment](const IndexSnapshot::Segment &source)
+                                         { return source.index == segment.index; });
+        if (source == sources.end())
+        {
+            next_snapshot->segments.push_back(segment);
+            continue;
+        }
+        if (source == sources.begin())
+        {
+            merged_position = next_snapshot->segments.size();
+            next_snapshot->segments.push_back({merged, nullptr, 0});
+        }
+        if (segment.deletions == source->deletions)
+        {
+            continue;
+        }
+        // Documents removed while the merge was running are still live in the merged segment
+        for (DocumentOrdinal ordinal = 0; ordinal < segment.index->GetOrdinalCount(); ++ordinal)
+        {
+            if (IsDeleted(segment, ordinal) && !IsDeleted(*source, ordinal))
+            {
+                if (!deletions)
+                {
+                    deletions = CopyDeletions({merged, nullptr, 0});
+                }
+                const int document_id = segment.index->GetDocument(ordinal).id;
+                MarkDeleted(*merged, *deletions, *merged->FindOrdinal(document_id));
+            }
+        }
+    }
+    auto &target = next_snapshot->segments[merged_position];
+    if (merged->GetOrdinalCount() == (deletions ? deletions->deleted_count : 0))
+    {
+        next_snapshot->segments.erase(next_snapshot->segments.begin() + merged_position);
+    }
+    else
+    {
+        target.deletions = std::move(deletions);
+    }
+    PublishSnapshot(std::move(next_snapshot));
+    return true;
+}
+
+std::vector<SearchServer::IndexSnapshot::Segment> SearchServer::SelectMerge(const IndexSnapshot &snapshot)
+{
+    // Rewriting a segment that consists mostly of tombstones frees its memory and speeds up its queries
+    for (const auto &segment : snapshot.segments)
+    {
+        const size_t ordinal_count = segment.index->GetOrdinalCount();
+        if (ordinal_count - GetLiveDocumentCount(segment) > ordinal_count * MAX_DELETED_DOCUMENT_SHARE)
+        {
+            return {segment};
+        }
+    }
+    // Segments are grouped into tiers by size, wherever they are in the snapshot. A tier that holds
+    // SEGMENT_MERGE_FACTOR segments merges into one segment of a higher tier, so a document is copied
+    // a logarithmic number of times and the number of segments stays logarithmic too
+    std::vector<std::vector<IndexSnapshot::Segment>> tiers;
+    for (const auto &segment : snapshot.segments)
+    {
+        const size_t tier = GetSegmentTier(segment);
+        if (tiers.size() <= tier)
+        {
+            tiers.resize(tier + 1);
+        }
+        tiers[tier].push_back(segment);
+    }
+    for (auto &tier : tiers)
+    {
+        if (tier.size() >= SEGMENT_MERGE_FACTOR)
+        {
+            return std::move(tier);
+        }
+    }
+    return {};
+}
+
+size_t SearchServer::GetSegmentTier(const IndexSnapshot::Segment &segment)
+{
+    size_t tier = 0;
+    for (size_t count = GetLiveDocumentCount(segment); count >= SEGMENT_MERGE_FACTOR; count /= SEGMENT_MERGE_FACTOR)
+    {
+        ++tier;
+    }
+    return tier;
+}
+
+std::shared_ptr<const IndexSegment> SearchServer::MergeSegments(const std::vector<IndexSnapshot::Segment> &segments,
+                                                                bool store_positions)
+{
+    size_t document_count = 0;
+    for (const auto &segment : segments)
+    {
+        document_count += GetLiveDocumentCount(segment);
+    }
+    std::vector<SegmentDocument> documents;
+    documents.reserve(document_count);
+    for (const auto &segment : segments)
+    {
+        const IndexSegment &index = *segment.index;
+        for (DocumentOrdinal ordinal = 0; ordinal < index.GetOrdinalCount(); ++ordinal)
+        {
+            if (!IsDeleted(segment, ordinal))
+            {
+                SegmentDocument &document = documents.emplace_back(SegmentDocument{index.GetDocument(ordinal), {}, {}});
+                index.ForEachWordCount(ordinal, [&index, &document](uint32_t term, uint32_t count)
+                                       { document.word_counts.push_back({index.GetTermId(term), index.GetTermWord(term), count}); });
+                if (store_positions)
+                {
+                    index.GetDocumentPositions(ordinal, document.positions);
+                }
+            }
+        }
+    }
+    return std::make_shared<const IndexSegment>(std::move(documents), store_positions);
+}
+
+std::string SearchServer::MakeQueryCacheKey(const Query &query, const DocumentFilter &filter, size_t max_count,
+                                            RankingFunction ranking_function)
+{
+    // Words never contain spaces or control characters, so the separators keep different queries apart
+    std::string key;
+    for (const std::string_view word : query.plus_words)
+    {
+        key += word;
+        key += ' ';
+    }
+    // Boosts follow in a section of their own, since words may contain any other character
+    if (!query.plus_word_boosts.empty())
+    {
+        key += '\x1d';
+        for (const double boost : query.plus_word_boosts)
+        {
+            key += std::to_string(boost);
+            key += ' ';
+        }
+    }
+    key += '\x1f';
+    for (const std::string_view word : query.minus_words)
+    {
+        key += word;
+        key += ' ';
+    }
+    key += '\x1f';
+    // Each constraint is its distance or '"' for a phrase, its words with their offsets and a terminator
+    for (const PositionConstraint &constraint : query.constraints)
+    {
+        key += constraint.max_distance ? std::to_string(*constraint.max_distance) : "\""s;
+        for (const auto &[word, offset] : constraint.words)
+        {
+            key += ' ';
+            key += word;
+            key += ' ';
+            key += std::to_string(offset);
+        }
+        key += '\x1e';
+    }
+    key += '\x1f';
+    // An absent condition is written as '*'
+    key += filter.status ? std::to_string(static_cast<int>(*filter.status)) : "*"s;
+    key += ' ';
+    key += filter.min_rating ? std::to_string(*filter.min_rating) : "*"s;
+    key += ' ';
+    key += std::to_string(max_count);
+    key += ' ';
+    key += std::to_string(static_cast<int>(ranking_function));
+    return key;
+}
+
+size_t SearchServer::ComputeShardCount(const IndexSnapshot &snapshot)
+{
+    // A few shards per thread let the scheduler balance shards of uneven cost
+    const size_t max_shard_count = 4 * std::max(1u, std::thread::hardware_concurrency());
+    return std::max<size_t>(1, std::min<size_t>(max_shard_count, snapshot.ordinal_count / MIN_SHARD_DOCUMENT_COUNT));
+}
+
+ScoreAccumulator &SearchServer::GetThreadScoreAccumulator()
 {
-    return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+    static thread_local ScoreAccumulator accumulator;
+    return accumulator;
 }
@@ -1,147 +1,813 @@
 #pragma once
 #include "string_processing.h"
 #include "document.h"
+#include "term_dictionary.h"
+#include "term_statistics.h"
+#include "scorers.h"
+#include "posting_list.h"
+#include "index_segment.h"
+#include "index_file.h"
+#include "top_documents.h"
+#include "score_accumulator.h"
+#include "query_cache.h"
+#include "metrics.h"
 #include <vector>
 #include <stdexcept>
 #include <algorithm>
 #include <set>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include <optional>
+#include <string_view>
+#include <execution>
+#include <numeric>
+#include <type_traits>
 
-const int MAX_RESULT_DOCUMENT_COUNT = 5;
-const double ACCURACY = 1e-6;
+const size_t MAX_RESULT_DOCUMENT_COUNT = 5;
+// Parallel queries split the ordinal space into shards of at least this many documents
+const size_t MIN_SHARD_DOCUMENT_COUNT = 4096;
+// Most terms a prefix or fuzzy plus word expands to; the closest and most frequent ones are kept
+const size_t MAX_TERM_EXPANSIONS = 64;
+// Fuzzy query words match terms at most this many edits away
+const uint32_t MAX_FUZZY_EDIT_DISTANCE = 2;
+// How many index segments of similar size are merged into one
+const size_t SEGMENT_MERGE_FACTOR = 8;
+// A segment with a larger share of removed documents is rewritten without them
+const double MAX_DELETED_DOCUMENT_SHARE = 0.3;
 
+// How FindTopDocuments walks the posting lists. Both modes return the same documents
+enum class RetrievalMode
+{
+    // Scores every document containing at least one plus word
+    EXHAUSTIVE,
+    // Document-at-a-time MaxScore: skips documents whose score upper bound cannot reach the current top
+    MAX_SCORE,
+};
+
+// Relevance formula of FindTopDocuments; each has a scorer policy in scorers.h
+enum class RankingFunction
+{
+    // Term frequency times inverse document frequency
+    TF_IDF,
+    // Okapi BM25 with document length normalization
+    BM25,
+};
+
+struct SearchServerOptions
+{
+    // Store the token positions of every word, which phrase and NEAR queries need. Positions are
+    // compressed per document and decoded only for candidates that match all plus words
+    bool index_positions = false;
+};
+
+// Queries read an immutable snapshot of index segments and are never blocked by writers.
+// AddDocument and RemoveDocument are serialized with each other and publish a new snapshot when done;
+// a background thread merges small segments and purges removed documents the same way.
+// Iteration with begin() and end() is the exception: it must not overlap with writes
 class SearchServer
 {
 public:
     template <typename StringContainer>
-    SearchServer(const StringContainer &stop_words)
-        : stop_words_(MakeUniqueNonEmptyStrings(stop_words))
+    SearchServer(const StringContainer &stop_words, const SearchServerOptions &options = {})
+        : stop_words_(MakeUniqueNonEmptyStrings(stop_words)), options_(options)
     {
         if (!std::all_of(stop_words_.begin(), stop_words_.end(), IsValidWord))
         {
             throw std::invalid_argument("Some of stop words are invalid");
         }
+        merge_thread_ = std::thread(&SearchServer::RunMerges, this);
     }
-    explicit SearchServer(const std::string &stop_words_text);
+    explicit SearchServer(const std::string &stop_words_text, const SearchServerOptions &options = {});
     explicit SearchServer();
-    void AddDocument(int document_id, const std::string &document, DocumentStatus status,
+    ~SearchServer();
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status,
                      const std::vector<int> &ratings);
 
+    // Besides plain and minus words, a query may contain "quoted phrases", whose words must occur consecutively,
+    // and word NEAR/k word pairs, whose words must occur at most k words apart in either order. Stop words
+    // count as words there. Both need SearchServerOptions::index_positions; otherwise such a query
+    // throws std::invalid_argument, as do unbalanced quotes and misplaced operators.
+    // A word pet* stands for the words that start with pet, and cat~ or cat~2 for the words within one
+    // or two edits of cat. A plus word expands to at most MAX_TERM_EXPANSIONS words, and a word d edits away
+    // contributes 1 / (1 + d) of its usual relevance; a minus word excludes all the words it stands for
+
     template <typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(const std::string &raw_query,
-                                           DocumentPredicate document_predicate) const;
-    std::vector<Document> FindTopDocuments(const std::string &raw_query, DocumentStatus status) const;
-    std::vector<Document> FindTopDocuments(const std::string &raw_query) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query,
+                                           DocumentPredicate document_predicate,
+                                           size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+                                           size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    // Skips postings of documents rejected by the filter's columns before scoring them
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, const DocumentFilter &filter,
+                                           size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
+    // std::execution::par scores shards of the document space concurrently and merges their tops;
+    // document_predicate is then called from several threads
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy &&policy, std::string_view raw_query,
+                                           DocumentPredicate document_predicate,
+                                           size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy &&policy, std::string_view raw_query,
+                                           DocumentStatus status,
+                                           size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy &&policy, std::string_view raw_query,
+                                           const DocumentFilter &filter,
+                                           size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy &&policy, std::string_view raw_query) const;
     size_t GetDocumentCount() const;
-    std::tuple<std::vector<std::string>, DocumentStatus> MatchDocument(const std::string &raw_query,
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query,
                                                                             int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::sequenced_policy &,
+                                                                       std::string_view raw_query,
+                                                                       int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy &,
+                                                                       std::string_view raw_query,
+                                                                       int document_id) const;
     std::set<int>::const_iterator begin() const;
     std::set<int>::const_iterator end() const;
 
-    const std::map<std::string, double> &GetWordFrequencies(int document_id) const;
+    std::map<std::string_view, double> GetWordFrequencies(int document_id) const;
+    // Sorted TermDictionary ids of the distinct words of the document; empty if there is no such document
+    std::vector<TermId> GetDocumentTermIds(int document_id) const;
 
     void RemoveDocument(int document_id);
+    void RemoveDocument(const std::execution::sequenced_policy &, int document_id);
+    // Removal only replaces the tombstones of one segment, so there is nothing to split between threads
+    void RemoveDocument(const std::execution::parallel_policy &, int document_id);
+    // Removes the documents in a single snapshot update; unknown ids are ignored
+    void RemoveDocuments(const std::vector<int> &document_ids);
+    void RemoveDocuments(const std::execution::sequenced_policy &, const std::vector<int> &document_ids);
+    // Looks the documents up and updates the tombstones of different segments concurrently;
+    // a large batch recounts the removed postings of its segment over all posting lists in parallel
+    void RemoveDocuments(const std::execution::parallel_policy &, const std::vector<int> &document_ids);
+
+    // Blocks until the background thread has merged everything written before the call
+    void WaitForMerges();
+
+    // Writes the stop words and live documents to a binary index file
+    void SaveIndex(const std::string &path) const;
+    // Opens a file written by SaveIndex. Queries read postings and documents straight from the mapped file,
+    // only the term dictionary is loaded into memory. Positions are indexed if the file has them
+    static std::unique_ptr<SearchServer> OpenIndex(const std::string &path);
+
+    void SetRetrievalMode(RetrievalMode mode);
+    RetrievalMode GetRetrievalMode() const;
+    // TF_IDF by default
+    void SetRankingFunction(RankingFunction ranking_function);
+    RankingFunction GetRankingFunction() const;
+    const SearchServerOptions &GetOptions() const;
+
+    // Caches the results of searches by status or DocumentFilter for up to capacity distinct queries; 0 turns
+    // the cache off, which is the default. Searches with a custom predicate are never cached. Every AddDocument and
+    // RemoveDocument invalidates the cached results; background merges do not, since they keep results intact
+    void SetQueryCacheCapacity(size_t capacity);
+    // Counters of the current cache; all zero while it is off
+    QueryCacheStats GetQueryCacheStats() const;
 
 private:
-    struct DocumentData
+    // Positional condition on plus words of a query
+    struct PositionConstraint
     {
-        int rating;
-        DocumentStatus status;
+        // A phrase matches where every word occurs at its offset from an occurrence of the first word
+        std::vector<std::pair<std::string_view, uint32_t>> words;
+        // Set for NEAR/k: the two words must occur at most k positions apart in either order
+        std::optional<uint32_t> max_distance;
     };
+    // Words point into the raw query; unless parsed without deduplication, they are sorted and unique
     struct Query
     {
-        std::set<std::string> plus_words;
-        std::set<std::string> minus_words;
+        std::vector<std::string_view> plus_words;
+        std::vector<std::string_view> minus_words;
+        // Words of the constraints are plus words too, so only documents with all of them are checked
+        std::vector<PositionConstraint> constraints;
+        // Factors of the plus word relevance; empty if all are 1, which holds unless words were expanded
+        std::vector<double> plus_word_boosts;
+
+        double GetBoost(size_t word_index) const
+        {
+            return plus_word_boosts.empty() ? 1.0 : plus_word_boosts[word_index];
+        }
     };
     struct QueryWord
     {
-        std::string data;
+        std::string_view data;
         bool is_minus;
         bool is_stop;
+        // data is a prefix of the words to search
+        bool is_prefix;
+        // Nonzero for a fuzzy word: data stands for the words within this many edits
+        uint32_t max_edit_distance;
+    };
+    struct PostingCursor
+    {
+        PostingIterator postings;
+        double term_weight;
+        double max_relevance;
+        size_t word_index;
+    };
+    // Scratch of FindTopDocumentsMaxScore, reused by all segments of a query
+    struct MaxScoreBuffers
+    {
+        std::vector<PostingCursor> cursors;
+        std::vector<PostingIterator> minus_postings;
+        std::vector<double> max_relevance_prefix;
+        std::vector<double> contributions;
+        std::vector<uint32_t> constraint_terms;
+    };
+    struct IndexSnapshot
+    {
+        struct Segment
+        {
+            std::shared_ptr<const IndexSegment> index;
+            // nullptr while no document of the segment is deleted
+            std::shared_ptr<const SegmentDeletions> deletions;
+            // Ordinals of the segment's documents in the snapshot start here
+            DocumentOrdinal first_ordinal;
+        };
+        std::vector<Segment> segments;
+        DocumentOrdinal ordinal_count = 0;
+        size_t document_count = 0;
+        // Document frequencies over the live documents of all segments, maintained by writers
+        std::shared_ptr<const TermStatistics> term_statistics = std::make_shared<const TermStatistics>();
+        // Words of the live documents except stop words
+        uint64_t word_count = 0;
+        // Computed once per snapshot, so an inverse document frequency costs a subtraction
+        CollectionStatistics collection_statistics;
+        // Incremented by every change of the document set, so cached results of older snapshots are not reused
+        uint64_t generation = 0;
+    };
+    struct DocumentLocation
+    {
+        size_t segment;
+        DocumentOrdinal ordinal;
     };
-    const std::set<std::string> stop_words_;
-    std::map<std::string, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, DocumentData> documents_;
+
+    const std::set<std::string, std::less<>> stop_words_;
+    const SearchServerOptions options_;
+    // Word storage shared by all segments; only writers access it
+    TermDictionary terms_;
+    std::shared_ptr<const IndexSnapshot> snapshot_ = std::make_shared<const IndexSnapshot>();
+    std::mutex write_mutex_;
     std::set<int> document_ids_;
-    std::map<int, std::map<std::string, double>> id_document_to_word_freqs_;
+    std::atomic<RetrievalMode> retrieval_mode_ = RetrievalMode::MAX_SCORE;
+    std::atomic<RankingFunction> ranking_function_ = RankingFunction::TF_IDF;
+    // nullptr while the cache is off
+    std::shared_ptr<QueryCache> query_cache_;
+
+    std::mutex merge_mutex_;
+    std::condition_variable merge_condition_;
+    bool merge_requested_ = false;
+    bool merging_ = false;
+    bool stop_merging_ = false;
+    std::thread merge_thread_;
 
-    bool IsStopWord(const std::string &word) const;
-    static bool IsValidWord(const std::string &word);
-    std::vector<std::string> SplitIntoWordsNoStop(const std::string &text) const;
+    bool IsStopWord(std::string_view word) const;
+    static bool IsValidWord(std::string_view word);
+    // SplitIntoWords has already rejected words with control characters.
+    // Also records the token index of every word, stop words included, in positions if it is not nullptr
+    std::vector<std::string_view> SplitIntoWordsNoStop(std::string_view text, std::vector<uint32_t> *positions = nullptr) const;
     static int ComputeAverageRating(const std::vector<int> &ratings);
-    QueryWord ParseQueryWord(const std::string &text) const;
-    Query ParseQuery(const std::string &text) const;
-    double ComputeWordInverseDocumentFreq(const std::string &word) const;
+    QueryWord ParseQueryWord(std::string_view text) const;
+    // Distance of a NEAR/k token; nullopt for other tokens
+    static std::optional<uint32_t> ParseNearOperator(std::string_view token);
+    // Prefix and fuzzy words are expanded to the words of the snapshot
+    Query ParseQuery(const IndexSnapshot &snapshot, std::string_view text, bool deduplicate = true) const;
+    // Appends the live terms the prefix or fuzzy word stands for to the plus or minus words
+    static void ExpandQueryWord(const IndexSnapshot &snapshot, const QueryWord &word, Query &query);
+    // Terms of the constraint words in the segment, in constraint order; false if the segment lacks one of them,
+    // so none of its documents can match
+    static bool FindConstraintTerms(const IndexSegment &index, const Query &query, std::vector<uint32_t> &terms);
+    // Decodes the positions of the constraint terms only
+    static bool MatchesConstraints(const IndexSegment &index, DocumentOrdinal ordinal, const Query &query,
+                                   const std::vector<uint32_t> &terms);
+    // Word of the index that equals word if the document contains it, otherwise an empty view
+    static std::string_view FindDocumentWord(const IndexSegment &index, DocumentOrdinal ordinal, std::string_view word);
+
+    std::shared_ptr<const IndexSnapshot> GetSnapshot() const;
+    void PublishSnapshot(std::shared_ptr<IndexSnapshot> snapshot);
+    static void UpdateSnapshotTotals(IndexSnapshot &snapshot);
+    static std::optional<DocumentLocation> FindDocument(const IndexSnapshot &snapshot, int document_id);
+    static bool IsDeleted(const IndexSnapshot::Segment &segment, DocumentOrdinal ordinal);
+    static size_t GetLiveDocumentCount(const IndexSnapshot::Segment &segment);
+    static std::shared_ptr<SegmentDeletions> CopyDeletions(const IndexSnapshot::Segment &segment);
+    static void MarkDeleted(const IndexSegment &index, SegmentDeletions &deletions, DocumentOrdinal ordinal);
+    // Sets deleted_document_freqs from is_deleted, scanning the posting lists in parallel
+    static void CountDeletedPostings(const IndexSegment &index, SegmentDeletions &deletions);
+    template <typename ExecutionPolicy>
+    void RemoveDocumentBatch(const ExecutionPolicy &policy, const std::vector<int> &document_ids);
+
+    // Segments are merged by a background thread; writers only append segments and replace tombstones
+    void RequestMerge();
+    void RunMerges();
+    // Performs one merge picked by SelectMerge; false if there was nothing to merge
+    bool MergeOnce();
+    // Segments to merge next; empty if the snapshot needs no merging. The order of segments
+    // in a snapshot does not matter, so they need not be adjacent
+    static std::vector<IndexSnapshot::Segment> SelectMerge(const IndexSnapshot &snapshot);
+    // Floor of the base SEGMENT_MERGE_FACTOR logarithm of the live document count
+    static size_t GetSegmentTier(const IndexSnapshot::Segment &segment);
+    // Live documents of the segments; deleted ones are dropped for good
+    static std::shared_ptr<const IndexSegment> MergeSegments(const std::vector<IndexSnapshot::Segment> &segments,
+                                                             bool store_positions);
+
+    // Looks the filtered search up in the query cache and runs it on a miss
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocumentsByFilter(const ExecutionPolicy &, std::string_view raw_query,
+                                                   const DocumentFilter &filter, size_t max_count) const;
+    // Normalized form of the query: equal for queries that differ only in word order and repetitions
+    static std::string MakeQueryCacheKey(const Query &query, const DocumentFilter &filter, size_t max_count,
+                                         RankingFunction ranking_function);
+    // Declarative filters read the index columns; other predicates are called with the document attributes
+    template <typename DocumentPredicate>
+    static bool MatchesPredicate(const IndexSegment &index, DocumentOrdinal ordinal, DocumentPredicate &document_predicate);
+
+    // Weight of the segment term for the scorer; nullopt if no live document has the term
+    template <typename Scorer>
+    static std::optional<double> GetTermWeight(const IndexSnapshot &snapshot, const IndexSegment &index, uint32_t term,
+                                               const Scorer &scorer);
+    // Search only among documents with snapshot ordinals in [first, last)
+    // Scores shards of the document space concurrently and merges their tops. The ranking function is read
+    // once per query by the caller, so a concurrent SetRankingFunction can not mix scorers within one search
     template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const Query &query,
-                                           DocumentPredicate document_predicate) const;
+    std::vector<Document> FindTopDocumentsParallel(const IndexSnapshot &snapshot, const Query &query,
+                                                   RankingFunction ranking_function,
+                                                   DocumentPredicate document_predicate, size_t max_count) const;
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocumentsInRange(const IndexSnapshot &snapshot, const Query &query,
+                                                  RankingFunction ranking_function,
+                                                  DocumentPredicate document_predicate, size_t max_count,
+                                                  DocumentOrdinal first, DocumentOrdinal last) const;
+    template <typename Scorer, typename DocumentPredicate>
+    std::vector<Document> FindTopDocumentsInRange(const IndexSnapshot &snapshot, const Query &query, const Scorer &scorer,
+                                                  DocumentPredicate &document_predicate, size_t max_count,
+                                                  DocumentOrdinal first, DocumentOrdinal last) const;
+    // Both search segment ordinals [first, last) and push the matches into top_documents
+    template <typename Scorer, typename DocumentPredicate>
+    static void FindAllDocuments(const IndexSnapshot &snapshot, const IndexSnapshot::Segment &segment,
+                                 const Query &query, const Scorer &scorer, DocumentPredicate &document_predicate,
+                                 DocumentOrdinal first, DocumentOrdinal last,
+                                 TopDocuments &top_documents);
+    template <typename Scorer, typename DocumentPredicate>
+    static void FindTopDocumentsMaxScore(const IndexSnapshot &snapshot, const IndexSnapshot::Segment &segment,
+                                         const Query &query, const Scorer &scorer, DocumentPredicate &document_predicate,
+                                         DocumentOrdinal first, DocumentOrdinal last,
+                                         TopDocuments &top_documents, MaxScoreBuffers &buffers);
+    static size_t ComputeShardCount(const IndexSnapshot &snapshot);
+    // Reused by every query executed on the calling thread
+    static ScoreAccumulator &GetThreadScoreAccumulator();
 };
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(const std::string &raw_query,
-                                                     DocumentPredicate document_predicate) const
-{
-    const auto query = ParseQuery(raw_query);
-    auto matched_documents = FindAllDocuments(query, document_predicate);
-
-    sort(matched_documents.begin(), matched_documents.end(),
-         [](const Document &lhs, const Document &rhs)
-         {
-             if (std::abs(lhs.relevance - rhs.relevance) < ACCURACY)
-             {
-                 return lhs.rating > rhs.rating;
-             }
-             else
-             {
-                 return lhs.relevance > rhs.relevance;
-             }
-         });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT)
-    {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
-    }
-    return matched_documents;
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query,
+                                                     DocumentPredicate document_predicate,
+                                                     size_t max_count) const
+{
+    METRICS_TIME_STAGE(MetricStage::QUERY);
+    const auto snapshot = GetSnapshot();
+    const auto query = ParseQuery(*snapshot, raw_query);
+    return FindTopDocumentsInRange(*snapshot, query, ranking_function_.load(), document_predicate, max_count, 0,
+                                   snapshot->ordinal_count);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy &&policy, std::string_view raw_query,
+                                                     DocumentPredicate document_predicate,
+                                                     size_t max_count) const
+{
+    if constexpr (std::is_same_v<std::decay_t<ExecutionPolicy>, std::execution::sequenced_policy>)
+    {
+        return FindTopDocuments(raw_query, document_predicate, max_count);
+    }
+    else
+    {
+        METRICS_TIME_STAGE(MetricStage::QUERY);
+        const auto snapshot = GetSnapshot();
+        return FindTopDocumentsParallel(*snapshot, ParseQuery(*snapshot, raw_query), ranking_function_.load(),
+                                        document_predicate, max_count);
+    }
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy &&policy, std::string_view raw_query,
+                                                     DocumentStatus status, size_t max_count) const
+{
+    return FindTopDocumentsByFilter(policy, raw_query, DocumentFilter{status, std::nullopt}, max_count);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy &&policy, std::string_view raw_query,
+                                                     const DocumentFilter &filter, size_t max_count) const
+{
+    return FindTopDocumentsByFilter(policy, raw_query, filter, max_count);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy &&policy, std::string_view raw_query) const
+{
+    return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocumentsByFilter(const ExecutionPolicy &, std::string_view raw_query,
+                                                             const DocumentFilter &filter, size_t max_count) const
+{
+    METRICS_TIME_STAGE(MetricStage::QUERY);
+    const auto snapshot = GetSnapshot();
+    const auto query = ParseQuery(*snapshot, raw_query);
+    // The cache key and the search must agree on the scorer
+    const RankingFunction ranking_function = ranking_function_;
+    const auto search = [&]()
+    {
+        if constexpr (std::is_same_v<ExecutionPolicy, std::execution::sequenced_policy>)
+        {
+            return FindTopDocumentsInRange(*snapshot, query, ranking_function, filter, max_count, 0,
+                                           snapshot->ordinal_count);
+        }
+        else
+        {
+            return FindTopDocumentsParallel(*snapshot, query, ranking_function, filter, max_count);
+        }
+    };
+    const auto query_cache = std::atomic_load(&query_cache_);
+    if (!query_cache)
+    {
+        return search();
+    }
+    std::string key = MakeQueryCacheKey(query, filter, max_count, ranking_function);
+    if (auto documents = query_cache->Find(key, snapshot->generation))
+    {
+        return std::move(*documents);
+    }
+    auto documents = search();
+    query_cache->Insert(std::move(key), snapshot->generation, documents);
+    return documents;
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocumentsParallel(const IndexSnapshot &snapshot, const Query &query,
+                                                             RankingFunction ranking_function,
+                                                             DocumentPredicate document_predicate, size_t max_count) const
+{
+    const size_t ordinal_count = snapshot.ordinal_count;
+    const size_t shard_count = ComputeShardCount(snapshot);
+    const size_t shard_size = (ordinal_count + shard_count - 1) / shard_count;
+    std::vector<size_t> shards(shard_count);
+    std::iota(shards.begin(), shards.end(), 0);
+    std::vector<std::vector<Document>> shard_documents(shard_count);
+    std::transform(std::execution::par, shards.begin(), shards.end(), shard_documents.begin(),
+                   [&](size_t shard)
+                   {
+                       const auto first = static_cast<DocumentOrdinal>(std::min(shard * shard_size, ordinal_count));
+                       const auto last = static_cast<DocumentOrdinal>(std::min(first + shard_size, ordinal_count));
+                       return FindTopDocumentsInRange(snapshot, query, ranking_function, document_predicate, max_count,
+                                                      first, last);
+                   });
+
+    // The global top is contained in the union of the shard tops
+    METRICS_TIME_STAGE(MetricStage::TOP_K);
+    TopDocuments top_documents(max_count);
+    for (const auto &documents : shard_documents)
+    {
+        for (const Document &document : documents)
+        {
+            top_documents.Push(document);
+        }
+    }
+    return top_documents.Extract();
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const Query &query,
-                                                     DocumentPredicate document_predicate) const
+std::vector<Document> SearchServer::FindTopDocumentsInRange(const IndexSnapshot &snapshot, const Query &query,
+                                                            RankingFunction ranking_function,
+                                                            DocumentPredicate document_predicate, size_t max_count,
+                                                            DocumentOrdinal first, DocumentOrdinal last) const
+{
+    // The only branch on the ranking function; everything below is compiled for the chosen scorer
+    switch (ranking_function)
+    {
+    case RankingFunction::BM25:
+        return FindTopDocumentsInRange(snapshot, query, Bm25Scorer(snapshot.collection_statistics), document_predicate,
+                                       max_count, first, last);
+    default:
+        return FindTopDocumentsInRange(snapshot, query, TfIdfScorer(snapshot.collection_statistics), document_predicate,
+                                       max_count, first, last);
+    }
+}
+
+template <typename Scorer, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocumentsInRange(const IndexSnapshot &snapshot, const Query &query,
+                                                            const Scorer &scorer, DocumentPredicate &document_predicate,
+                                                            size_t max_count, DocumentOrdinal first,
+                                                            DocumentOrdinal last) const
 {
-    std::map<int, double> document_to_relevance;
-    for (const std::string &word : query.plus_words)
+    const RetrievalMode mode = retrieval_mode_;
+    // One heap for all segments, so the MaxScore threshold reached in one segment prunes the next ones
+    TopDocuments top_documents(max_count);
+    MaxScoreBuffers buffers;
+    uint64_t searched_segment_count = 0;
+    for (const auto &segment : snapshot.segments)
     {
-        if (word_to_document_freqs_.count(word) == 0)
+        const DocumentOrdinal segment_first = segment.first_ordinal;
+        const DocumentOrdinal segment_last = segment_first + static_cast<DocumentOrdinal>(segment.index->GetOrdinalCount());
+        if (segment_last <= first || last <= segment_first)
         {
             continue;
         }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto &[document_id, term_freq] : word_to_document_freqs_.at(word))
+        ++searched_segment_count;
+        const DocumentOrdinal local_first = std::max(first, segment_first) - segment_first;
+        const DocumentOrdinal local_last = std::min(last, segment_last) - segment_first;
+        if (mode == RetrievalMode::MAX_SCORE)
+        {
+            FindTopDocumentsMaxScore(snapshot, segment, query, scorer, document_predicate, local_first, local_last,
+                                     top_documents, buffers);
+        }
+        else
         {
-            const auto &document_data = documents_.at(document_id);
-            if (document_predicate(document_id, document_data.status, document_data.rating))
+            FindAllDocuments(snapshot, segment, query, scorer, document_predicate, local_first, local_last, top_documents);
+        }
+    }
+    METRICS_ADD(MetricCounter::SEARCHED_SEGMENTS, searched_segment_count);
+    METRICS_TIME_STAGE(MetricStage::TOP_K);
+    return top_documents.Extract();
+}
+
+template <typename Scorer>
+std::optional<double> SearchServer::GetTermWeight(const IndexSnapshot &snapshot, const IndexSegment &index, uint32_t term,
+                                                  const Scorer &scorer)
+{
+    const TermStatistic &statistic = snapshot.term_statistics->Get(index.GetTermId(term));
+    if (statistic.document_freq == 0)
+    {
+        return std::nullopt;
+    }
+    return scorer.GetTermWeight(statistic);
+}
+
+template <typename DocumentPredicate>
+bool SearchServer::MatchesPredicate(const IndexSegment &index, DocumentOrdinal ordinal, DocumentPredicate &document_predicate)
+{
+    if constexpr (std::is_same_v<std::decay_t<DocumentPredicate>, DocumentFilter>)
+    {
+        return index.MatchesFilter(ordinal, document_predicate);
+    }
+    else
+    {
+        const DocumentData &document_data = index.GetDocument(ordinal);
+        return document_predicate(document_data.id, document_data.status, document_data.rating);
+    }
+}
+
+template <typename Scorer, typename DocumentPredicate>
+void SearchServer::FindAllDocuments(const IndexSnapshot &snapshot, const IndexSnapshot::Segment &segment,
+                                    const Query &query, const Scorer &scorer, DocumentPredicate &document_predicate,
+                                    DocumentOrdinal first, DocumentOrdinal last,
+                                    TopDocuments &top_documents)
+{
+    const IndexSegment &index = *segment.index;
+    std::vector<uint32_t> constraint_terms;
+    if (!query.constraints.empty() && !FindConstraintTerms(index, query, constraint_terms))
+    {
+        return;
+    }
+    const std::vector<bool> *is_deleted = segment.deletions ? &segment.deletions->is_deleted : nullptr;
+    ScoreAccumulator &accumulator = GetThreadScoreAccumulator();
+    const ScoreAccumulatorGuard accumulator_guard(accumulator);
+    accumulator.Reserve(index.GetOrdinalCount());
+    uint64_t predicate_call_count = 0;
+    {
+        METRICS_TIME_STAGE(MetricStage::RETRIEVAL);
+        for (const std::string_view word : query.minus_words)
+        {
+            const auto term = index.FindTerm(word);
+            if (!term)
+            {
+                continue;
+            }
+            index.GetPostings(*term).ForEachPosting(first, last, [&accumulator](DocumentOrdinal ordinal, uint32_t)
+                                                    { accumulator.Exclude(ordinal); });
+        }
+
+        for (size_t word_index = 0; word_index < query.plus_words.size(); ++word_index)
+        {
+            const auto term = index.FindTerm(query.plus_words[word_index]);
+            if (!term)
             {
-                document_to_relevance[document_id] += term_freq * inverse_document_freq;
+                continue;
             }
+            auto term_weight = GetTermWeight(snapshot, index, *term, scorer);
+            if (!term_weight)
+            {
+                continue;
+            }
+            *term_weight *= query.GetBoost(word_index);
+            index.GetPostings(*term).ForEachPosting(
+                first, last,
+                [&index, &accumulator, &document_predicate, is_deleted, &scorer, &term_weight,
+                 &predicate_call_count](DocumentOrdinal ordinal, uint32_t term_count)
+                {
+                    if (accumulator.IsExcluded(ordinal) || (is_deleted && (*is_deleted)[ordinal]))
+                    {
+                        return;
+                    }
+                    ++predicate_call_count;
+                    if (MatchesPredicate(index, ordinal, document_predicate))
+                    {
+                        accumulator.Add(ordinal, scorer.Score(*term_weight, term_count, index.GetDocument(ordinal).word_count));
+                    }
+                });
         }
     }
+    METRICS_ADD(MetricCounter::PREDICATE_CALLS, predicate_call_count);
+
+    METRICS_TIME_STAGE(MetricStage::TOP_K);
+    uint64_t scored_document_count = 0;
+    accumulator.ForEach([&index, &query, &constraint_terms, &top_documents, &scored_document_count](DocumentOrdinal ordinal,
+                                                                                                    double relevance)
+                        {
+                            if (!query.constraints.empty() && !MatchesConstraints(index, ordinal, query, constraint_terms))
+                            {
+                                return;
+                            }
+                            const DocumentData &document_data = index.GetDocument(ordinal);
+                            top_documents.Push({document_data.id, relevance, document_data.rating});
+                            ++scored_document_count;
+                        });
+    METRICS_ADD(MetricCounter::SCORED_DOCUMENTS, scored_document_count);
+}
 
-    for (const std::string &word : query.minus_words)
+template <typename Scorer, typename DocumentPredicate>
+void SearchServer::FindTopDocumentsMaxScore(const IndexSnapshot &snapshot, const IndexSnapshot::Segment &segment,
+                                            const Query &query, const Scorer &scorer, DocumentPredicate &document_predicate,
+                                            DocumentOrdinal first, DocumentOrdinal last,
+                                            TopDocuments &top_documents, MaxScoreBuffers &buffers)
+{
+    METRICS_TIME_STAGE(MetricStage::RETRIEVAL);
+    const IndexSegment &index = *segment.index;
+    std::vector<uint32_t> &constraint_terms = buffers.constraint_terms;
+    if (!query.constraints.empty() && !FindConstraintTerms(index, query, constraint_terms))
     {
-        if (word_to_document_freqs_.count(word) == 0)
+        return;
+    }
+    std::vector<PostingCursor> &cursors = buffers.cursors;
+    cursors.clear();
+    cursors.reserve(query.plus_words.size());
+    for (size_t word_index = 0; word_index < query.plus_words.size(); ++word_index)
+    {
+        const auto term = index.FindTerm(query.plus_words[word_index]);
+        if (!term)
         {
             continue;
         }
-        for (const auto &[document_id, _] : word_to_document_freqs_.at(word))
+        if (const auto term_weight = GetTermWeight(snapshot, index, *term, scorer))
+        {
+            // Scores of both scorers are proportional to the term weight, so the boost scales their bounds too
+            const double boosted_weight = *term_weight * query.GetBoost(word_index);
+            const PostingList postings = index.GetPostings(*term);
+            cursors.push_back({PostingIterator(postings, first, last), boosted_weight,
+                               scorer.GetMaxScore(boosted_weight, postings), word_index});
+        }
+    }
+    std::vector<PostingIterator> &minus_postings = buffers.minus_postings;
+    minus_postings.clear();
+    minus_postings.reserve(query.minus_words.size());
+    for (const std::string_view word : query.minus_words)
+    {
+        const auto term = index.FindTerm(word);
+        if (term)
         {
-            document_to_relevance.erase(document_id);
+            minus_postings.emplace_back(index.GetPostings(*term), first, last);
         }
     }
 
-    std::vector<Document> matched_documents;
-    for (const auto &[document_id, relevance] : document_to_relevance)
+    std::sort(cursors.begin(), cursors.end(), [](const PostingCursor &lhs, const PostingCursor &rhs)
+              { return lhs.max_relevance < rhs.max_relevance; });
+    // max_relevance_prefix[i] bounds the relevance a document can collect from lists [0, i]
+    std::vector<double> &max_relevance_prefix = buffers.max_relevance_prefix;
+    max_relevance_prefix.resize(cursors.size());
+    double max_relevance_sum = 0.0;
+    for (size_t i = 0; i < cursors.size(); ++i)
     {
-        matched_documents.push_back(
-            {document_id, relevance, documents_.at(document_id).rating});
+        max_relevance_sum += cursors[i].max_relevance;
+        max_relevance_prefix[i] = max_relevance_sum;
+    }
+
+    std::vector<double> &contributions = buffers.contributions;
+    contributions.resize(query.plus_words.size());
+    // Lists before first_essential can not lift a document into the top on their own,
+    // so they are only probed for candidates found in the essential lists
+    size_t first_essential = 0;
+    uint64_t predicate_call_count = 0;
+    uint64_t scored_document_count = 0;
+    while (true)
+    {
+        while (first_essential < cursors.size() && !top_documents.CanAccept(max_relevance_prefix[first_essential]))
+        {
+            ++first_essential;
+        }
+        bool has_candidate = false;
+        DocumentOrdinal ordinal = 0;
+        for (size_t i = first_essential; i < cursors.size(); ++i)
+        {
+            const PostingIterator &postings = cursors[i].postings;
+            if (!postings.IsEnd() && (!has_candidate || postings.GetOrdinal() < ordinal))
+            {
+                ordinal = postings.GetOrdinal();
+                has_candidate = true;
+            }
+        }
+        if (!has_candidate)
+        {
+            break;
+        }
+        if constexpr (std::is_same_v<std::decay_t<DocumentPredicate>, DocumentFilter>)
+        {
+            // The essential lists skip straight to the next document with the filter's status
+            ++predicate_call_count;
+            if (!index.MatchesFilter(ordinal, document_predicate))
+            {
+                const DocumentOrdinal next = index.FindFilterCandidate(ordinal + 1, document_predicate);
+                for (size_t i = first_essential; i < cursors.size(); ++i)
+                {
+                    PostingIterator &postings = cursors[i].postings;
+                    if (!postings.IsEnd() && postings.GetOrdinal() < next)
+                    {
+                        postings.Seek(next);
+                    }
+                }
+                continue;
+            }
+        }
+
+        std::fill(contributions.begin(), contributions.end(), 0.0);
+        const uint32_t document_length = index.GetDocument(ordinal).word_count;
+        double relevance_bound = 0.0;
+        for (size_t i = first_essential; i < cursors.size(); ++i)
+        {
+            PostingCursor &cursor = cursors[i];
+            if (!cursor.postings.IsEnd() && cursor.postings.GetOrdinal() == ordinal)
+            {
+                const double contribution = scorer.Score(cursor.term_weight, cursor.postings.GetTermCount(), document_length);
+                contributions[cursor.word_index] = contribution;
+                relevance_bound += contribution;
+                cursor.postings.Next();
+            }
+        }
+        bool is_pruned = false;
+        for (size_t i = first_essential; i-- > 0;)
+        {
+            if (!top_documents.CanAccept(relevance_bound + max_relevance_prefix[i]))
+            {
+                is_pruned = true;
+                break;
+            }
+            PostingCursor &cursor = cursors[i];
+            if (cursor.postings.Seek(ordinal))
+            {
+                const double contribution = scorer.Score(cursor.term_weight, cursor.postings.GetTermCount(), document_length);
+                contributions[cursor.word_index] = contribution;
+                relevance_bound += contribution;
+            }
+        }
+        if (is_pruned || !top_documents.CanAccept(relevance_bound) || IsDeleted(segment, ordinal))
+        {
+            continue;
+        }
+        if (std::any_of(minus_postings.begin(), minus_postings.end(), [ordinal](PostingIterator &postings)
+                        { return postings.Seek(ordinal); }))
+        {
+            continue;
+        }
+        // Positions are decoded only for the few documents that get this far
+        if (!query.constraints.empty() && !MatchesConstraints(index, ordinal, query, constraint_terms))
+        {
+            continue;
+        }
+        // A filter has been checked already; other predicates are left for last, since they may be expensive
+        if constexpr (!std::is_same_v<std::decay_t<DocumentPredicate>, DocumentFilter>)
+        {
+            ++predicate_call_count;
+            if (!MatchesPredicate(index, ordinal, document_predicate))
+            {
+                continue;
+            }
+        }
+        const DocumentData &document_data = index.GetDocument(ordinal);
+        // Same summation order as FindAllDocuments, so both modes produce bit-identical relevance
+        double relevance = 0.0;
+        for (const double contribution : contributions)
+        {
+            relevance += contribution;
+        }
+        top_documents.Push({document_data.id, relevance, document_data.rating});
+        ++scored_document_count;
     }
-    return matched_documents;
+    METRICS_ADD(MetricCounter::PREDICATE_CALLS, predicate_call_count);
+    METRICS_ADD(MetricCounter::SCORED_DOCUMENTS, scored_document_count);
 }
@@ -1,32 +1,105 @@
 #include "string_processing.h"
+#include <stdexcept>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+using namespace std::literals::string_literals;
 
-std::vector<std::string> SplitIntoWords(const std::string &text)
+namespace
 {
-    std::vector<std::string> words;
-    if (text.empty())
+    bool IsControl(char c)
     {
-        return words;
+        return c >= '\0' && c < ' ';
     }
-    std::string word;
-    for (const char c : text)
+
+    [[noreturn]] void ThrowInvalidWord(std::string_view text, size_t position)
+    {
+        const size_t space_before = text.rfind(' ', position);
+        const size_t begin = space_before == std::string_view::npos ? 0 : space_before + 1;
+        const std::string_view word = text.substr(begin, text.find(' ', position) - begin);
+        throw std::invalid_argument("Word "s + std::string(word) + " is invalid"s);
+    }
+
+    // Tracks whether the scan is inside a word across the chunks of the text
+    class WordSplitter
     {
-        if (c == ' ')
+    public:
+        WordSplitter(std::string_view text, std::vector<std::string_view> &words)
+            : text_(text), words_(words) {}
+
+        // Starts a word at position, or ends the current one there
+        void Toggle(size_t position)
         {
-            if (!word.empty())
+            if (in_word_)
+            {
+                words_.push_back(text_.substr(word_begin_, position - word_begin_));
+            }
+            else
             {
-                words.push_back(word);
-                word.clear();
+                word_begin_ = position;
             }
+            in_word_ = !in_word_;
         }
-        else
+
+        bool InWord() const
         {
-            word += c;
+            return in_word_;
+        }
+
+    private:
+        std::string_view text_;
+        std::vector<std::string_view> &words_;
+        size_t word_begin_ = 0;
+        bool in_word_ = false;
+    };
+}
+
+std::vector<std::string_view> SplitIntoWords(std::string_view text)
+{
+    std::vector<std::string_view> words;
+    SplitIntoWords(text, words);
+    return words;
+}
+
+void SplitIntoWords(std::string_view text, std::vector<std::string_view> &words)
+{
+    WordSplitter splitter(text, words);
+    size_t position = 0;
+#if defined(__SSE2__)
+    // Classifies 16 characters at once: the bits where a word starts or ends are handled one by one,
+    // while runs of word characters and of spaces are skipped whole
+    const __m128i spaces = _mm_set1_epi8(' ');
+    const __m128i minus_one = _mm_set1_epi8(-1);
+    for (; position + 16 <= text.size(); position += 16)
+    {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text.data() + position));
+        const unsigned control_mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmplt_epi8(chunk, spaces), _mm_cmpgt_epi8(chunk, minus_one))));
+        if (control_mask != 0)
+        {
+            ThrowInvalidWord(text, position + __builtin_ctz(control_mask));
+        }
+        const unsigned word_mask = ~static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, spaces))) & 0xFFFF;
+        unsigned transitions = word_mask ^ ((word_mask << 1 | (splitter.InWord() ? 1 : 0)) & 0xFFFF);
+        for (; transitions != 0; transitions &= transitions - 1)
+        {
+            splitter.Toggle(position + __builtin_ctz(transitions));
         }
     }
-    if (!word.empty())
+#endif
+    for (; position < text.size(); ++position)
     {
-        words.push_back(word);
+        if (IsControl(text[position]))
+        {
+            ThrowInvalidWord(text, position);
+        }
+        if ((text[position] != ' ') != splitter.InWord())
+        {
+            splitter.Toggle(position);
+        }
     }
-
-    return words;
-}
\ No newline at end of file
+    if (splitter.InWord())
+    {
+        splitter.Toggle(text.size());
+    }
+}
@@ -1,17 +1,23 @@
 #pragma once
+#include <functional>
 #include <set>
 #include <vector>
 #include <string>
+#include <string_view>
 
-std::vector<std::string> SplitIntoWords(const std::string& text);
+// Splits text into words separated by spaces. The words point into text.
+// Throws std::invalid_argument if a word contains a control character
+std::vector<std::string_view> SplitIntoWords(std::string_view text);
+// Same, but appends the words to a caller-provided vector
+void SplitIntoWords(std::string_view text, std::vector<std::string_view>& words);
 
 template <typename StringContainer>
-std::set<std::string> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
-    std::set<std::string> non_empty_strings;
-    for (const std::string& str : strings) {
+std::set<std::string, std::less<>> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
+    std::set<std::string, std::less<>> non_empty_strings;
+    for (const std::string_view str : strings) {
         if (!str.empty()) {
-            non_empty_strings.insert(str);
+            non_empty_strings.emplace(str);
         }
     }
     return non_empty_strings;
-}
\ No newline at end of file
+}
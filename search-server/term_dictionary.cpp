@@ -0,0 +1,52 @@
+#include "term_dictionary.h"
+
+TermDictionary::TermDictionary(const TermDictionary &other)
+    : terms_(other.terms_)
+{
+    term_to_id_.reserve(terms_.size());
+    for (TermId term_id = 0; term_id < terms_.size(); ++term_id)
+    {
+        term_to_id_.emplace(terms_[term_id], term_id);
+    }
+}
+
+TermDictionary &TermDictionary::operator=(const TermDictionary &other)
+{
+    if (this != &other)
+    {
+        TermDictionary copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+TermId TermDictionary::Intern(std::string_view term)
+{
+    if (const auto it = term_to_id_.find(term); it != term_to_id_.end())
+    {
+        return it->second;
+    }
+    const TermId term_id = static_cast<TermId>(terms_.size());
+    const std::string &stored = terms_.emplace_back(term);
+    term_to_id_.emplace(stored, term_id);
+    return term_id;
+}
+
+std::optional<TermId> TermDictionary::Find(std::string_view term) const
+{
+    if (const auto it = term_to_id_.find(term); it != term_to_id_.end())
+    {
+        return it->second;
+    }
+    return std::nullopt;
+}
+
+std::string_view TermDictionary::GetTerm(TermId term_id) const
+{
+    return terms_.at(term_id);
+}
+
+size_t TermDictionary::GetTermCount() const
+{
+    return terms_.size();
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using TermId = uint32_t;
+
+// Stores every distinct word once and assigns it a dense id in order of first appearance
+class TermDictionary
+{
+public:
+    TermDictionary() = default;
+    TermDictionary(const TermDictionary &other);
+    TermDictionary(TermDictionary &&other) = default;
+    TermDictionary &operator=(const TermDictionary &other);
+    TermDictionary &operator=(TermDictionary &&other) = default;
+
+    TermId Intern(std::string_view term);
+    std::optional<TermId> Find(std::string_view term) const;
+    std::string_view GetTerm(TermId term_id) const;
+    size_t GetTermCount() const;
+
+private:
+    // deque keeps addresses of stored words stable, so the index can hold views into them
+    std::deque<std::string> terms_;
+    std::unordered_map<std::string_view, TermId> term_to_id_;
+};
@@ -0,0 +1,36 @@
+#include "term_statistics.h"
+#include <cmath>
+
+const TermStatistic TermStatistics::EMPTY;
+
+TermStatistics::TermStatistics(const TermStatistics &other)
+    : directories_(other.directories_), is_directory_owned_(other.directories_.size(), false) {}
+
+void TermStatistics::AddDocumentFreq(TermId term_id, int64_t delta)
+{
+    const size_t page = term_id / TERM_STATISTICS_PAGE_SIZE;
+    const size_t directory = page / TERM_STATISTICS_DIRECTORY_SIZE;
+    if (directory >= directories_.size())
+    {
+        directories_.resize(directory + 1);
+        is_directory_owned_.resize(directory + 1, false);
+    }
+    // Shared directories and pages may belong to a published table, which readers must keep seeing unchanged
+    std::shared_ptr<Directory> &directory_ptr = directories_[directory];
+    if (!is_directory_owned_[directory])
+    {
+        directory_ptr = directory_ptr ? std::make_shared<Directory>(*directory_ptr) : std::make_shared<Directory>();
+        directory_ptr->is_page_owned.reset();
+        is_directory_owned_[directory] = true;
+    }
+    const size_t directory_page = page % TERM_STATISTICS_DIRECTORY_SIZE;
+    std::shared_ptr<Page> &page_ptr = directory_ptr->pages[directory_page];
+    if (!directory_ptr->is_page_owned[directory_page])
+    {
+        page_ptr = page_ptr ? std::make_shared<Page>(*page_ptr) : std::make_shared<Page>();
+        directory_ptr->is_page_owned[directory_page] = true;
+    }
+    TermStatistic &statistic = (*page_ptr)[term_id % TERM_STATISTICS_PAGE_SIZE];
+    statistic.document_freq = static_cast<uint32_t>(statistic.document_freq + delta);
+    statistic.log_document_freq = statistic.document_freq > 0 ? std::log(statistic.document_freq) : 0.0;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "term_dictionary.h"
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Terms of a TermStatistics page
+const size_t TERM_STATISTICS_PAGE_SIZE = 64;
+// Pages of a TermStatistics directory
+const size_t TERM_STATISTICS_DIRECTORY_SIZE = 64;
+
+struct TermStatistic
+{
+    // Number of live documents that contain the term
+    uint32_t document_freq = 0;
+    // Natural logarithm of document_freq, so scoring only subtracts it from the logarithm of the document count
+    double log_document_freq = 0.0;
+};
+
+// Collection statistics of every TermDictionary term, indexed by TermId and stored in a two-level tree
+// of small pages. Copies share the tree; a writer copies the published table, updates it and publishes the copy,
+// which duplicates only the pages and directories on the way to the changed terms
+class TermStatistics
+{
+public:
+    TermStatistics() = default;
+    // The copy shares every directory and page until it changes one
+    TermStatistics(const TermStatistics &other);
+    TermStatistics &operator=(const TermStatistics &) = delete;
+
+    // Zero statistics for terms the table has not seen yet
+    const TermStatistic &Get(TermId term_id) const
+    {
+        const size_t page = term_id / TERM_STATISTICS_PAGE_SIZE;
+        const size_t directory = page / TERM_STATISTICS_DIRECTORY_SIZE;
+        if (directory >= directories_.size() || !directories_[directory])
+        {
+            return EMPTY;
+        }
+        const auto &page_ptr = directories_[directory]->pages[page % TERM_STATISTICS_DIRECTORY_SIZE];
+        return page_ptr ? (*page_ptr)[term_id % TERM_STATISTICS_PAGE_SIZE] : EMPTY;
+    }
+
+    void AddDocumentFreq(TermId term_id, int64_t delta);
+
+private:
+    using Page = std::array<TermStatistic, TERM_STATISTICS_PAGE_SIZE>;
+    struct Directory
+    {
+        std::array<std::shared_ptr<Page>, TERM_STATISTICS_DIRECTORY_SIZE> pages;
+        // Pages created for the table that owns the directory, which no other table refers to
+        std::bitset<TERM_STATISTICS_DIRECTORY_SIZE> is_page_owned;
+    };
+
+    static const TermStatistic EMPTY;
+
+    std::vector<std::shared_ptr<Directory>> directories_;
+    // Directories created by this table
+    std::vector<bool> is_directory_owned_;
+};
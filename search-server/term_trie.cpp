@@ -0,0 +1,25 @@
+#include "term_trie.h"
+#include <numeric>
+
+TermTrie::TermTrie(const std::vector<std::string_view> &words)
+    : terms_(words.size())
+{
+    std::iota(terms_.begin(), terms_.end(), 0);
+    std::sort(terms_.begin(), terms_.end(), [&words](uint32_t lhs, uint32_t rhs)
+              { return words[lhs] < words[rhs]; });
+    sorted_words_.reserve(words.size());
+    for (const uint32_t term : terms_)
+    {
+        sorted_words_.push_back(words[term]);
+    }
+}
+
+std::optional<uint32_t> TermTrie::Find(std::string_view word) const
+{
+    const auto it = std::lower_bound(sorted_words_.begin(), sorted_words_.end(), word);
+    if (it == sorted_words_.end() || *it != word)
+    {
+        return std::nullopt;
+    }
+    return terms_[it - sorted_words_.begin()];
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// Vocabulary of a segment in lexicographic order, which is an implicit trie: the terms below a prefix
+// form a contiguous range, found by binary search. Prefix and fuzzy searches walk the trie and skip
+// whole subtrees, while the structure costs a view and a term number per word. Find is a binary search;
+// segments keep a hash map for the exact lookups of query words
+class TermTrie
+{
+public:
+    TermTrie() = default;
+    // Term t is words[t]; the views must outlive the trie
+    explicit TermTrie(const std::vector<std::string_view> &words);
+
+    std::optional<uint32_t> Find(std::string_view word) const;
+    // Calls func(term) for every term that starts with prefix
+    template <typename Func>
+    void ForEachWithPrefix(std::string_view prefix, Func func) const;
+    // Calls func(term, distance) for every term within max_distance Levenshtein edits of word. Walks the trie
+    // with one row of the edit distance table per depth, like a Levenshtein automaton, and leaves a subtree
+    // as soon as no cell of the row is within max_distance
+    template <typename Func>
+    void ForEachWithinDistance(std::string_view word, uint32_t max_distance, Func func) const;
+
+private:
+    // Terms below a trie node: the range of sorted words that share its prefix
+    struct TrieRange
+    {
+        size_t first;
+        size_t last;
+        size_t depth;
+    };
+
+    std::vector<std::string_view> sorted_words_;
+    // Term number of every sorted word
+    std::vector<uint32_t> terms_;
+};
+
+template <typename Func>
+void TermTrie::ForEachWithPrefix(std::string_view prefix, Func func) const
+{
+    auto word = std::lower_bound(sorted_words_.begin(), sorted_words_.end(), prefix);
+    for (; word != sorted_words_.end() && word->substr(0, prefix.size()) == prefix; ++word)
+    {
+        func(terms_[word - sorted_words_.begin()]);
+    }
+}
+
+template <typename Func>
+void TermTrie::ForEachWithinDistance(std::string_view word, uint32_t max_distance, Func func) const
+{
+    if (sorted_words_.empty())
+    {
+        return;
+    }
+    const size_t width = word.size() + 1;
+    // Row d holds the distances between the node prefix of length d and every prefix of word
+    std::vector<uint32_t> rows(width);
+    for (size_t i = 0; i < width; ++i)
+    {
+        rows[i] = static_cast<uint32_t>(i);
+    }
+    std::vector<TrieRange> stack{{0, sorted_words_.size(), 0}};
+    while (!stack.empty())
+    {
+        auto [first, last, depth] = stack.back();
+        stack.pop_back();
+        if (depth > 0)
+        {
+            // Children are popped before the siblings of their parent, so row depth - 1 is the parent's
+            if (rows.size() < (depth + 1) * width)
+            {
+                rows.resize((depth + 1) * width);
+            }
+            const uint32_t *parent = rows.data() + (depth - 1) * width;
+            uint32_t *row = rows.data() + depth * width;
+            const char c = sorted_words_[first][depth - 1];
+            row[0] = static_cast<uint32_t>(depth);
+            for (size_t i = 1; i < width; ++i)
+            {
+                row[i] = std::min({parent[i] + 1, row[i - 1] + 1, parent[i - 1] + (word[i - 1] == c ? 0 : 1)});
+            }
+            if (*std::min_element(row, row + width) > max_distance)
+            {
+                continue;
+            }
+        }
+        // A word that ends at the node sorts before the longer words of its subtree
+        if (sorted_words_[first].size() == depth)
+        {
+            const uint32_t distance = rows[depth * width + word.size()];
+            if (distance <= max_distance)
+            {
+                func(terms_[first], distance);
+            }
+            ++first;
+        }
+        while (first < last)
+        {
+            const char c = sorted_words_[first][depth];
+            const size_t child_last = std::partition_point(sorted_words_.begin() + first, sorted_words_.begin() + last,
+                                                           [depth, c](std::string_view child)
+                                                           { return child[depth] == c; }) -
+                                      sorted_words_.begin();
+            stack.push_back({first, child_last, depth + 1});
+            first = child_last;
+        }
+    }
+}
@@ -1,5 +1,18 @@
 #include "test_example_functions.h"
+#include "index_file.h"
+#include "process_queries.h"
+#include "remove_duplicates.h"
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <execution>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <thread>
 
 using namespace std::literals::string_literals;
 
@@ -109,14 +122,14 @@ void TestMatchingDocs() {
     }
     {
         const auto& [matched_words, status] = server.MatchDocument(query, 2);
-        const std::vector<std::string> res_matched_words = { "cat"s, "city"s };
+        const std::vector<std::string_view> res_matched_words = { "cat", "city" };
         const DocumentStatus res_status = DocumentStatus::ACTUAL;
         ASSERT_EQUAL_HINT(matched_words, res_matched_words, "The server return incorrect result"s);
         ASSERT_EQUAL_HINT(status, res_status, "The server return incorrect status"s);
     }
     {
         const auto& [matched_words, status] = server.MatchDocument(query, 3);
-        const std::vector<std::string> res_matched_words = { "cat"s };
+        const std::vector<std::string_view> res_matched_words = { "cat" };
         const DocumentStatus res_status = DocumentStatus::ACTUAL;
         ASSERT_EQUAL_HINT(matched_words, res_matched_words, "The server return incorrect result"s);
         ASSERT_EQUAL_HINT(status, res_status, "The server return incorrect status"s);
@@ -127,6 +140,16 @@ void TestMatchingDocs() {
         const DocumentStatus res_status = DocumentStatus::ACTUAL;
         ASSERT_EQUAL_HINT(status, res_status, "The server return incorrect status"s);
     }
+    {
+        // Matched words point into the index, not into the query
+        std::vector<std::string_view> matched_words;
+        {
+            const std::string temporary_query = "village cat"s;
+            matched_words = std::get<0>(server.MatchDocument(temporary_query, 3));
+        }
+        const std::vector<std::string_view> res_matched_words = { "cat", "village" };
+        ASSERT_EQUAL_HINT(matched_words, res_matched_words, "The server return incorrect result"s);
+    }
 }
 
 void TestSortedFindDocs() {
@@ -284,6 +307,1142 @@ void TestRelevanceTopDocs() {
     }
 }
 
+void TestWordFrequencies() {
+    SearchServer server("in the"s);
+    server.AddDocument(1, "cat in the city cat"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(2, "dog in the city"s, DocumentStatus::ACTUAL, { 1 });
+    {
+        const auto word_freqs = server.GetWordFrequencies(1);
+        ASSERT_EQUAL_HINT(word_freqs.size(), 2, "The server stores a wrong set of document words"s);
+        ASSERT_HINT(std::abs(word_freqs.at("cat"s) - 2.0 / 3) < ACCURACY, "The server counts term frequency incorrectly"s);
+        ASSERT_HINT(std::abs(word_freqs.at("city"s) - 1.0 / 3) < ACCURACY, "The server counts term frequency incorrectly"s);
+    }
+    server.RemoveDocument(1);
+    ASSERT_HINT(server.GetWordFrequencies(1).empty(), "Word frequencies of a removed document must be empty"s);
+    ASSERT_EQUAL_HINT(server.GetWordFrequencies(2).size(), 2, "Removing a document affects other documents"s);
+    ASSERT_HINT(server.FindTopDocuments("cat"s).empty(), "The server finds a removed document"s);
+    ASSERT_EQUAL_HINT(server.FindTopDocuments("city"s).size(), 1, "The server incorrectly finds the document"s);
+}
+
+void TestUnorderedDocumentIds() {
+    SearchServer server;
+    server.AddDocument(9, "cat in the city"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(2, "cat in the village"s, DocumentStatus::ACTUAL, { 2 });
+    server.AddDocument(5, "cat on the roof"s, DocumentStatus::ACTUAL, { 3 });
+    server.AddDocument(7, "dog on the roof"s, DocumentStatus::ACTUAL, { 4 });
+    ASSERT_EQUAL_HINT(server.FindTopDocuments("cat"s).size(), 3, "The server loses documents added out of id order"s);
+    server.RemoveDocument(5);
+    server.RemoveDocument(2);
+    const auto found_docs = server.FindTopDocuments("cat"s);
+    ASSERT_EQUAL_HINT(found_docs.size(), 1, "The server finds removed documents"s);
+    ASSERT_EQUAL_HINT(found_docs[0].id, 9, "The server finds removed documents"s);
+    const auto& [matched_words, status] = server.MatchDocument("cat roof"s, 7);
+    const std::vector<std::string_view> res_matched_words = { "roof" };
+    ASSERT_EQUAL_HINT(matched_words, res_matched_words, "Removing a document affects other documents"s);
+}
+
+void TestTopDocumentsCount() {
+    SearchServer server("in the"s);
+    const std::vector<std::string> words = { "cat"s, "dog"s, "city"s, "village"s, "sky"s, "roof"s };
+    for (int id = 0; id < 40; ++id) {
+        std::string text;
+        for (int i = 0; i <= id % 5; ++i) {
+            text += words[(id * 7 + i * 3) % words.size()] + " "s;
+        }
+        server.AddDocument(id, text, DocumentStatus::ACTUAL, { id % 7 });
+    }
+    const std::string query = "cat city sky -roof"s;
+    const auto all_docs = server.FindTopDocuments(query, DocumentStatus::ACTUAL, 100);
+    ASSERT_HINT(all_docs.size() > MAX_RESULT_DOCUMENT_COUNT, "The server ignores the requested number of documents"s);
+    for (size_t i = 1; i < all_docs.size(); ++i) {
+        ASSERT_HINT(!TopDocuments::IsMoreRelevant(all_docs[i], all_docs[i - 1]), "The server does not sort documents correctly"s);
+    }
+    const auto top_docs = server.FindTopDocuments(query);
+    ASSERT_EQUAL_HINT(top_docs.size(), MAX_RESULT_DOCUMENT_COUNT, "The server returns an incorrect number of documents"s);
+    for (size_t i = 0; i < top_docs.size(); ++i) {
+        ASSERT_HINT(std::abs(top_docs[i].relevance - all_docs[i].relevance) < ACCURACY, "The top of the result does not match the full ranking"s);
+        ASSERT_EQUAL_HINT(top_docs[i].rating, all_docs[i].rating, "The top of the result does not match the full ranking"s);
+    }
+    ASSERT_EQUAL(server.FindTopDocuments(query, DocumentStatus::ACTUAL, 2).size(), 2);
+    ASSERT_HINT(server.FindTopDocuments(query, DocumentStatus::ACTUAL, 0).empty(), "The server ignores the requested number of documents"s);
+}
+
+void TestMaxScoreMatchesExhaustive() {
+    std::mt19937 generator(42);
+    const std::vector<std::string> words = { "cat"s, "dog"s, "city"s, "village"s, "sky"s, "roof"s, "funny"s, "pet"s, "rat"s, "hair"s };
+    SearchServer server("and in the"s);
+    for (int id = 0; id < 300; ++id) {
+        std::string text;
+        const int length = 1 + static_cast<int>(generator() % 8);
+        for (int i = 0; i < length; ++i) {
+            // A skewed choice makes the first words common and the last ones rare
+            text += words[std::min(generator() % words.size(), generator() % words.size())] + " "s;
+        }
+        server.AddDocument(id, text, static_cast<DocumentStatus>(id % 3), { static_cast<int>(generator() % 10) });
+    }
+    const std::vector<std::string> queries = { "cat"s, "cat dog city"s, "funny pet rat hair -sky"s, "hair rat"s,
+        "cat dog city village sky roof funny pet rat hair"s, "-cat dog"s, "unknown words"s };
+    const auto compare = [&server](const auto& find) {
+        server.SetRetrievalMode(RetrievalMode::EXHAUSTIVE);
+        const std::vector<Document> expected = find();
+        server.SetRetrievalMode(RetrievalMode::MAX_SCORE);
+        const std::vector<Document> actual = find();
+        ASSERT_EQUAL_HINT(actual.size(), expected.size(), "MaxScore returns a different number of documents"s);
+        for (size_t i = 0; i < actual.size(); ++i) {
+            ASSERT_EQUAL_HINT(actual[i].id, expected[i].id, "MaxScore returns different documents"s);
+            ASSERT_EQUAL_HINT(actual[i].relevance, expected[i].relevance, "MaxScore computes a different relevance"s);
+            ASSERT_EQUAL_HINT(actual[i].rating, expected[i].rating, "MaxScore returns different documents"s);
+        }
+    };
+    for (const RankingFunction ranking_function : { RankingFunction::TF_IDF, RankingFunction::BM25 }) {
+        server.SetRankingFunction(ranking_function);
+        for (const std::string& query : queries) {
+            for (const size_t max_count : { size_t(0), size_t(1), MAX_RESULT_DOCUMENT_COUNT, size_t(50), size_t(1000) }) {
+                compare([&] { return server.FindTopDocuments(query, DocumentStatus::ACTUAL, max_count); });
+                compare([&] { return server.FindTopDocuments(query, [](int document_id, DocumentStatus, int rating) { return rating > 4 && document_id % 2 == 0; }, max_count); });
+            }
+        }
+    }
+}
+
+void TestParallelMatchesSequential() {
+    std::mt19937 generator(7);
+    const std::vector<std::string> words = { "cat"s, "dog"s, "city"s, "village"s, "sky"s, "roof"s, "funny"s, "pet"s, "rat"s, "hair"s };
+    SearchServer server("and in the"s);
+    const int document_count = static_cast<int>(3 * MIN_SHARD_DOCUMENT_COUNT);
+    for (int id = 0; id < document_count; ++id) {
+        std::string text;
+        const int length = 1 + static_cast<int>(generator() % 6);
+        for (int i = 0; i < length; ++i) {
+            text += words[std::min(generator() % words.size(), generator() % words.size())] + " "s;
+        }
+        server.AddDocument(id, text, static_cast<DocumentStatus>(id % 2), { static_cast<int>(generator() % 10) });
+    }
+    for (int id = 0; id < document_count; id += 3) {
+        server.RemoveDocument(std::execution::par, id);
+    }
+    ASSERT_EQUAL(server.GetDocumentCount(), static_cast<size_t>(document_count - document_count / 3));
+    const std::vector<std::string> queries = { "cat"s, "funny pet rat hair -sky"s, "hair rat"s, "-cat dog village"s };
+    for (const RetrievalMode mode : { RetrievalMode::EXHAUSTIVE, RetrievalMode::MAX_SCORE }) {
+        server.SetRetrievalMode(mode);
+        for (const std::string& query : queries) {
+            for (const size_t max_count : { size_t(1), MAX_RESULT_DOCUMENT_COUNT, size_t(100) }) {
+                const auto expected = server.FindTopDocuments(query, DocumentStatus::ACTUAL, max_count);
+                const auto actual = server.FindTopDocuments(std::execution::par, query, DocumentStatus::ACTUAL, max_count);
+                ASSERT_EQUAL_HINT(actual.size(), expected.size(), "Parallel search returns a different number of documents"s);
+                for (size_t i = 0; i < actual.size(); ++i) {
+                    ASSERT_EQUAL_HINT(actual[i].id, expected[i].id, "Parallel search returns different documents"s);
+                    ASSERT_EQUAL_HINT(actual[i].relevance, expected[i].relevance, "Parallel search computes a different relevance"s);
+                }
+            }
+        }
+    }
+    for (const std::string& query : { "cat dog -village pet"s, "pet dog cat dog pet -sky -sky"s }) {
+        for (int id = 1; id < 200; id += 3) {
+            const auto [expected_words, expected_status] = server.MatchDocument(query, id);
+            const auto [actual_words, actual_status] = server.MatchDocument(std::execution::par, query, id);
+            ASSERT_EQUAL_HINT(actual_words, expected_words, "Parallel matching returns different words"s);
+            ASSERT_EQUAL(actual_status, expected_status);
+        }
+    }
+}
+
+void TestConcurrentReadsAndWrites() {
+    SearchServer server("and in the"s);
+    const int stable_count = 100;
+    for (int id = 0; id < stable_count; ++id) {
+        server.AddDocument(id, "funny cat number "s + std::to_string(id), DocumentStatus::ACTUAL, { id % 10 });
+    }
+    std::atomic<bool> done = false;
+    std::thread writer([&server, &done] {
+        for (int round = 0; round < 20; ++round) {
+            for (int id = 1000; id < 1100; ++id) {
+                server.AddDocument(id, "grumpy dog"s, DocumentStatus::ACTUAL, { 1 });
+            }
+            for (int id = 1000; id < 1100; ++id) {
+                server.RemoveDocument(id);
+            }
+        }
+        done = true;
+    });
+    std::vector<std::thread> readers;
+    for (int reader = 0; reader < 2; ++reader) {
+        readers.emplace_back([&server, &done, stable_count] {
+            while (!done) {
+                const auto documents = server.FindTopDocuments("cat -dog"s, [](int, DocumentStatus, int) { return true; }, 1000);
+                ASSERT_EQUAL_HINT(documents.size(), static_cast<size_t>(stable_count), "Readers must see every stable document"s);
+                const auto [words, status] = server.MatchDocument("cat dog"s, stable_count / 2);
+                ASSERT_EQUAL(words.size(), 1u);
+                const size_t document_count = server.GetDocumentCount();
+                ASSERT(document_count >= static_cast<size_t>(stable_count) && document_count <= static_cast<size_t>(stable_count + 100));
+            }
+        });
+    }
+    writer.join();
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    ASSERT_EQUAL(server.GetDocumentCount(), static_cast<size_t>(stable_count));
+    ASSERT(server.FindTopDocuments("dog"s).empty());
+}
+
+void TestBackgroundMergeKeepsResults() {
+    SearchServer server("and in the"s);
+    const std::vector<std::string> words = { "cat"s, "dog"s, "city"s, "village"s, "sky"s, "roof"s };
+    for (int id = 0; id < 500; ++id) {
+        server.AddDocument(id, words[id % 6] + " "s + words[id % 5] + " "s + words[id % 4], DocumentStatus::ACTUAL, { id % 7 });
+        if (id % 4 == 3) {
+            server.RemoveDocument(id - 2);
+        }
+    }
+    const auto expected = server.FindTopDocuments("cat sky -roof"s, DocumentStatus::ACTUAL, 100);
+    server.WaitForMerges();
+    const auto actual = server.FindTopDocuments("cat sky -roof"s, DocumentStatus::ACTUAL, 100);
+    ASSERT_EQUAL(server.GetDocumentCount(), 375u);
+    ASSERT_EQUAL_HINT(actual.size(), expected.size(), "Merging changes the number of found documents"s);
+    for (size_t i = 0; i < actual.size(); ++i) {
+        ASSERT_EQUAL_HINT(actual[i].id, expected[i].id, "Merging changes the found documents"s);
+        ASSERT_EQUAL_HINT(actual[i].relevance, expected[i].relevance, "Merging changes the relevance"s);
+    }
+    for (int id = 0; id < 500; id += 2) {
+        server.RemoveDocument(id);
+    }
+    server.WaitForMerges();
+    ASSERT_EQUAL(server.GetDocumentCount(), 125u);
+    for (int id = 1; id < 500; id += 2) {
+        ASSERT_EQUAL_HINT(server.GetWordFrequencies(id).empty(), id % 4 == 1, "Removed documents must stay removed after merging"s);
+    }
+}
+
+void TestSaveAndOpenIndex() {
+    const std::string path = (std::filesystem::temp_directory_path() / "search_server_test.index").string();
+    SearchServer server("and in the"s);
+    const std::vector<std::string> words = { "cat"s, "dog"s, "city"s, "village"s, "sky"s, "roof"s, "the"s };
+    for (int id = 0; id < 200; ++id) {
+        server.AddDocument(id, words[id % 7] + " "s + words[id % 5] + " "s + words[id % 3], static_cast<DocumentStatus>(id % 3), { id % 9, 1 });
+    }
+    for (int id = 0; id < 200; id += 7) {
+        server.RemoveDocument(id);
+    }
+    server.SaveIndex(path);
+    const auto opened = SearchServer::OpenIndex(path);
+    ASSERT_EQUAL(opened->GetDocumentCount(), server.GetDocumentCount());
+    ASSERT(std::equal(opened->begin(), opened->end(), server.begin(), server.end()));
+    for (const std::string& query : { "cat sky"s, "the dog -roof"s, "village city -cat"s }) {
+        for (const DocumentStatus status : { DocumentStatus::ACTUAL, DocumentStatus::IRRELEVANT }) {
+            const auto expected = server.FindTopDocuments(query, status, 50);
+            const auto actual = opened->FindTopDocuments(query, status, 50);
+            ASSERT_EQUAL_HINT(actual.size(), expected.size(), "Opened index finds a different number of documents"s);
+            for (size_t i = 0; i < actual.size(); ++i) {
+                ASSERT_EQUAL(actual[i].id, expected[i].id);
+                ASSERT_EQUAL(actual[i].relevance, expected[i].relevance);
+                ASSERT_EQUAL(actual[i].rating, expected[i].rating);
+            }
+        }
+    }
+    ASSERT(opened->GetWordFrequencies(10) == server.GetWordFrequencies(10));
+    ASSERT(opened->MatchDocument("cat dog village"s, 10) == server.MatchDocument("cat dog village"s, 10));
+
+    opened->AddDocument(500, "cat in the village"s, DocumentStatus::ACTUAL, { 5 });
+    opened->RemoveDocument(1);
+    opened->WaitForMerges();
+    ASSERT_EQUAL(opened->GetDocumentCount(), server.GetDocumentCount());
+    ASSERT_EQUAL(std::get<0>(opened->MatchDocument("village in"s, 500)), std::vector<std::string_view>{ "village" });
+
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(200);
+        file.put('\x7f');
+    }
+    bool is_rejected = false;
+    try {
+        SearchServer::OpenIndex(path);
+    } catch (const std::runtime_error&) {
+        is_rejected = true;
+    }
+    ASSERT_HINT(is_rejected, "A corrupted index file must be rejected"s);
+
+    // Arrays that decoding indexes with are checked at open, even when the checksum is right
+    server.SaveIndex(path);
+    const IndexFile file = ReadIndexFile(path);
+    std::vector<TermId> term_ids(file.terms.size());
+    std::iota(term_ids.begin(), term_ids.end(), 0);
+    const std::string rewritten_path = path + ".rewritten"s;
+    const auto is_rejected_with = [&](const SegmentArrays& arrays) {
+        WriteIndexFile(rewritten_path, {}, IndexSegment(arrays, term_ids, file.terms, nullptr));
+        bool is_rejected = false;
+        try {
+            SearchServer::OpenIndex(rewritten_path);
+        } catch (const std::runtime_error&) {
+            is_rejected = true;
+        }
+        std::filesystem::remove(rewritten_path);
+        return is_rejected;
+    };
+    ASSERT(!is_rejected_with(file.arrays));
+    const uint64_t posting_count = file.arrays.forward_offsets[file.arrays.document_count];
+    std::vector<uint32_t> forward_terms(file.arrays.forward_terms, file.arrays.forward_terms + posting_count);
+    forward_terms.back() = static_cast<uint32_t>(file.arrays.term_count);
+    SegmentArrays arrays = file.arrays;
+    arrays.forward_terms = forward_terms.data();
+    ASSERT_HINT(is_rejected_with(arrays), "A forward term past the terms must be rejected"s);
+    std::vector<DocumentIdOrdinal> document_ordinals(file.arrays.document_ordinals,
+        file.arrays.document_ordinals + file.arrays.document_count);
+    arrays = file.arrays;
+    arrays.document_ordinals = document_ordinals.data();
+    std::swap(document_ordinals[0], document_ordinals[1]);
+    ASSERT_HINT(is_rejected_with(arrays), "Unsorted document ordinals must be rejected"s);
+    std::swap(document_ordinals[0], document_ordinals[1]);
+    document_ordinals.back().ordinal = static_cast<DocumentOrdinal>(file.arrays.document_count);
+    ASSERT_HINT(is_rejected_with(arrays), "A document ordinal past the documents must be rejected"s);
+    std::filesystem::remove(path);
+}
+
+void TestPostingListCodec() {
+    std::mt19937 generator(11);
+    std::vector<DocumentOrdinal> ordinals;
+    std::vector<uint32_t> counts;
+    DocumentOrdinal ordinal = 0;
+    for (int i = 0; i < 1000; ++i) {
+        // Mixes dense runs with long gaps, so blocks get different bit widths
+        ordinal += i % 300 < 150 ? 1 : 1 + generator() % 100000;
+        ordinals.push_back(ordinal);
+        counts.push_back(i % 200 < 100 ? 1 : 1 + generator() % 70000);
+    }
+    std::vector<PostingBlock> blocks;
+    std::vector<uint32_t> words;
+    EncodePostings(ordinals.data(), counts.data(), ordinals.size(), blocks, words);
+    words.resize(words.size() + POSTING_WORD_PADDING);
+    const PostingList postings(blocks.data(), blocks.size(), words.data(), ordinals.size(), 1.0);
+    ASSERT_EQUAL(postings.GetBlockCount(), (ordinals.size() + POSTING_BLOCK_SIZE - 1) / POSTING_BLOCK_SIZE);
+
+    size_t i = 0;
+    for (PostingIterator it(postings, 0, ordinals.back() + 1); !it.IsEnd(); it.Next(), ++i) {
+        ASSERT_EQUAL(it.GetOrdinal(), ordinals[i]);
+        ASSERT_EQUAL(it.GetTermCount(), counts[i]);
+    }
+    ASSERT_EQUAL(i, ordinals.size());
+
+    for (size_t j = 0; j < ordinals.size(); j += 37) {
+        ASSERT(postings.Contains(ordinals[j]));
+        ASSERT(!postings.Contains(ordinals[j] + 1) || ordinals[j + 1] == ordinals[j] + 1);
+    }
+    const DocumentOrdinal first = ordinals[300] + 1;
+    const DocumentOrdinal last = ordinals[700];
+    PostingIterator range(postings, first, last);
+    ASSERT_EQUAL(range.GetOrdinal(), ordinals[301]);
+    ASSERT(range.Seek(ordinals[650]));
+    ASSERT_EQUAL(range.GetTermCount(), counts[650]);
+    ASSERT(!range.Seek(ordinals[650] + 1) || ordinals[651] == ordinals[650] + 1);
+    ASSERT(!range.Seek(last));
+    ASSERT(range.IsEnd());
+}
+
+void TestSplitIntoWords() {
+    ASSERT(SplitIntoWords(""s).empty());
+    ASSERT(SplitIntoWords("    "s).empty());
+    const std::string text = "  cat in   the city "s;
+    const std::vector<std::string_view> words = SplitIntoWords(text);
+    ASSERT_EQUAL(words.size(), 4u);
+    ASSERT_EQUAL(words[0], "cat"s);
+    ASSERT_EQUAL(words[3], "city"s);
+    ASSERT(words[0].data() == text.data() + 2);
+
+    // Word and space runs of every length cross the chunk boundaries of the vectorized scan
+    std::mt19937 generator(13);
+    for (int round = 0; round < 200; ++round) {
+        std::string random_text;
+        std::vector<std::string> expected;
+        while (random_text.size() < 100) {
+            random_text.append(1 + generator() % 20, ' ');
+            const std::string word(1 + generator() % 20, static_cast<char>('a' + generator() % 26));
+            random_text += word;
+            expected.push_back(word);
+        }
+        const std::vector<std::string_view> random_words = SplitIntoWords(random_text);
+        ASSERT_EQUAL(std::vector<std::string>(random_words.begin(), random_words.end()), expected);
+
+        std::string invalid_text = random_text;
+        invalid_text[generator() % invalid_text.size()] = '\x12';
+        bool thrown = false;
+        try {
+            SplitIntoWords(invalid_text);
+        } catch (const std::invalid_argument&) {
+            thrown = true;
+        }
+        ASSERT(thrown);
+    }
+    ASSERT_EQUAL(SplitIntoWords("\xD1\xE8\xED\xE8\xE9 \xEA\xEE\xF2"s).size(), 2u);
+}
+
+void TestRemoveDocuments() {
+    std::mt19937 generator(17);
+    const std::vector<std::string> words = { "cat"s, "dog"s, "city"s, "village"s, "sky"s, "roof"s, "funny"s, "pet"s, "rat"s, "hair"s };
+    SearchServer one_by_one("in the"s);
+    SearchServer sequential("in the"s);
+    SearchServer parallel("in the"s);
+    const int document_count = 5000;
+    for (int id = 0; id < document_count; ++id) {
+        std::string text;
+        for (int i = 0; i < 4; ++i) {
+            text += words[generator() % words.size()] + " "s;
+        }
+        for (SearchServer* server : { &one_by_one, &sequential, &parallel }) {
+            server->AddDocument(id, text, DocumentStatus::ACTUAL, { id % 7 });
+        }
+    }
+    parallel.WaitForMerges();
+
+    // Small batches update the removed postings per document, the large one recounts whole segments
+    std::vector<std::vector<int>> batches = { { 1, 5, 5, document_count + 10 }, {} };
+    for (int id = 0; id < document_count; id += 2) {
+        batches.back().push_back(id);
+    }
+    for (const auto& batch : batches) {
+        for (const int id : batch) {
+            one_by_one.RemoveDocument(id);
+        }
+        sequential.RemoveDocuments(batch);
+        parallel.RemoveDocuments(std::execution::par, batch);
+        ASSERT_EQUAL(sequential.GetDocumentCount(), one_by_one.GetDocumentCount());
+        ASSERT_EQUAL(parallel.GetDocumentCount(), one_by_one.GetDocumentCount());
+        for (const std::string& query : { "cat dog"s, "funny -pet"s, "hair rat sky"s }) {
+            const auto expected = one_by_one.FindTopDocuments(query);
+            for (const SearchServer* server : { &sequential, &parallel }) {
+                const auto actual = server->FindTopDocuments(query);
+                ASSERT_EQUAL(actual.size(), expected.size());
+                for (size_t i = 0; i < actual.size(); ++i) {
+                    ASSERT_EQUAL(actual[i].id, expected[i].id);
+                    ASSERT_EQUAL(actual[i].relevance, expected[i].relevance);
+                }
+            }
+        }
+    }
+    ASSERT_EQUAL(parallel.GetDocumentCount(), static_cast<size_t>(document_count / 2 - 2));
+    ASSERT_EQUAL(std::distance(parallel.begin(), parallel.end()), document_count / 2 - 2);
+    parallel.WaitForMerges();
+    ASSERT_EQUAL(parallel.GetDocumentCount(), static_cast<size_t>(document_count / 2 - 2));
+    ASSERT(parallel.GetWordFrequencies(1).empty());
+}
+
+void TestFindDuplicates() {
+    SearchServer server("and with"s);
+    server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, { 1, 2 });
+    // Same words as 2, other counts and order
+    server.AddDocument(3, "curly hair funny pet pet"s, DocumentStatus::ACTUAL, { 1, 2 });
+    // Differs from 2 by a stop word only
+    server.AddDocument(4, "funny pet and curly hair"s, DocumentStatus::ACTUAL, { 1, 2 });
+    server.AddDocument(5, "funny funny pet and nasty nasty rat"s, DocumentStatus::ACTUAL, { 1, 2 });
+    server.AddDocument(6, "funny pet and not very nasty rat"s, DocumentStatus::ACTUAL, { 1, 2 });
+    server.AddDocument(7, "very nasty rat and not very funny pet"s, DocumentStatus::ACTUAL, { 1, 2 });
+    server.AddDocument(8, "pet with rat and rat and rat"s, DocumentStatus::ACTUAL, { 1, 2 });
+    ASSERT_EQUAL(server.GetDocumentTermIds(3), server.GetDocumentTermIds(2));
+    ASSERT(server.GetDocumentTermIds(100).empty());
+    ASSERT_EQUAL(FindDuplicates(server), (std::vector<int>{ 3, 4, 5, 7 }));
+
+    std::ostringstream output;
+    std::streambuf* const cout_buffer = std::cout.rdbuf(output.rdbuf());
+    RemoveDuplicates(server);
+    std::cout.rdbuf(cout_buffer);
+    ASSERT_EQUAL(server.GetDocumentCount(), 4u);
+    ASSERT(FindDuplicates(server).empty());
+}
+
+void TestFindNearDuplicates() {
+    std::mt19937 generator(19);
+    std::vector<std::string> words;
+    for (int i = 0; i < 5000; ++i) {
+        words.push_back("w"s + std::to_string(i));
+    }
+    SearchServer server;
+    int id = 0;
+    std::vector<std::vector<int>> expected;
+    for (int cluster = 0; cluster < 50; ++cluster) {
+        std::vector<std::string> text_words;
+        for (int i = 0; i < 100; ++i) {
+            text_words.push_back(words[generator() % words.size()]);
+        }
+        expected.emplace_back();
+        // Copies replace two words each, which keeps their similarity to the original above 0.9
+        for (int copy = 0; copy < 3; ++copy) {
+            std::string text;
+            for (size_t i = 0; i < text_words.size(); ++i) {
+                text += (copy > 0 && i % 50 == static_cast<size_t>(copy) ? "unique"s + std::to_string(id) + "_"s + std::to_string(i) : text_words[i]) + " "s;
+            }
+            expected.back().push_back(id);
+            server.AddDocument(id++, text, DocumentStatus::ACTUAL, { 1 });
+        }
+    }
+    const auto clusters = FindNearDuplicates(server, 0.8);
+    ASSERT_EQUAL(clusters.size(), expected.size());
+    for (size_t i = 0; i < clusters.size(); ++i) {
+        ASSERT_EQUAL(clusters[i], expected[i]);
+    }
+    ASSERT(FindDuplicates(server).empty());
+}
+
+void TestQueryExecutor() {
+    QueryExecutor executor(3);
+    ASSERT_EQUAL(executor.GetThreadCount(), 3u);
+    ASSERT_EQUAL(executor.GetCurrentWorkerIndex(), 3u);
+    ASSERT(executor.Submit([&executor] { return executor.GetCurrentWorkerIndex(); }).get() < 3u);
+
+    std::vector<std::atomic<int>> calls(1000);
+    executor.ParallelFor(calls.size(), [&executor, &calls](size_t i) {
+        // Nested loops run on the same pool without deadlocking
+        executor.ParallelFor(3, [&calls, i](size_t) { ++calls[i]; });
+    });
+    ASSERT(std::all_of(calls.begin(), calls.end(), [](const std::atomic<int>& count) { return count == 3; }));
+
+    bool thrown = false;
+    try {
+        executor.ParallelFor(100, [](size_t i) {
+            if (i == 42) {
+                throw std::out_of_range("42"s);
+            }
+        });
+    } catch (const std::out_of_range&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    auto failed = executor.Submit([]() -> int { throw std::invalid_argument("failed"s); });
+    thrown = false;
+    try {
+        failed.get();
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+
+    SearchServer server("and with"s);
+    int id = 0;
+    for (const std::string& text : { "funny pet and nasty rat"s, "funny pet with curly hair"s, "funny pet and not very nasty rat"s,
+                                     "pet with rat and rat and rat"s, "nasty rat with curly hair"s }) {
+        server.AddDocument(++id, text, DocumentStatus::ACTUAL, { 1, 2 });
+    }
+    const std::vector<std::string> queries = { "nasty rat -not"s, "not very funny nasty pet"s, "curly hair"s, "sky"s };
+    std::vector<std::future<std::vector<Document>>> futures;
+    for (const std::string& query : queries) {
+        futures.push_back(executor.SubmitQuery(server, query));
+    }
+    const auto results = ProcessQueries(executor, server, queries);
+    const auto joined_results = ProcessQueriesJoined(server, queries);
+    const std::vector<Document> joined(joined_results.begin(), joined_results.end());
+    ASSERT_EQUAL(results.size(), queries.size());
+    size_t joined_position = 0;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        const auto expected = server.FindTopDocuments(queries[i]);
+        const auto submitted = futures[i].get();
+        ASSERT_EQUAL(results[i].size(), expected.size());
+        ASSERT_EQUAL(submitted.size(), expected.size());
+        for (size_t j = 0; j < expected.size(); ++j) {
+            ASSERT_EQUAL(results[i][j].id, expected[j].id);
+            ASSERT_EQUAL(submitted[j].id, expected[j].id);
+            ASSERT_EQUAL(joined[joined_position++].id, expected[j].id);
+        }
+    }
+    ASSERT_EQUAL(joined_position, joined.size());
+}
+
+void TestProcessQueriesJoinedStreaming() {
+    std::mt19937 generator(23);
+    const std::vector<std::string> words = { "cat"s, "dog"s, "city"s, "village"s, "sky"s, "roof"s, "funny"s, "pet"s, "rat"s, "hair"s };
+    SearchServer server("in the"s);
+    for (int id = 0; id < 1000; ++id) {
+        server.AddDocument(id, words[generator() % words.size()] + " "s + words[generator() % words.size()], DocumentStatus::ACTUAL, { id % 5 });
+    }
+    std::vector<std::string> queries;
+    for (int i = 0; i < 2000; ++i) {
+        // Some queries match nothing
+        queries.push_back(i % 7 == 0 ? "unknown"s : words[generator() % words.size()] + " -"s + words[generator() % words.size()]);
+    }
+    QueryExecutor executor(2);
+    std::vector<Document> expected;
+    for (const std::string& query : queries) {
+        for (const Document& document : server.FindTopDocuments(query)) {
+            expected.push_back(document);
+        }
+    }
+    const JoinedQueryResults results = ProcessQueriesJoined(executor, server, queries);
+    ASSERT_EQUAL(results.GetQueryCount(), queries.size());
+    size_t position = 0;
+    for (const Document& document : results) {
+        ASSERT(position < expected.size());
+        ASSERT_EQUAL(document.id, expected[position].id);
+        ASSERT_EQUAL(document.relevance, expected[position].relevance);
+        ++position;
+    }
+    ASSERT_EQUAL(position, expected.size());
+    ASSERT_EQUAL(results.GetQueryDocuments(1).size(), server.FindTopDocuments(queries[1]).size());
+
+    // Stopping early must not wait for the whole batch or leave tasks reading the queries
+    {
+        const JoinedQueryResults partial = ProcessQueriesJoined(executor, server, queries);
+        ASSERT_EQUAL(partial.begin()->id, expected.front().id);
+    }
+
+    // The results keep their own copy of a temporary batch, which is gone before they are read
+    const auto make_queries = []() { return std::vector<std::string>{ "cat"s, "unknown"s, "dog -cat"s }; };
+    std::vector<Document> temporary_expected;
+    for (const std::string& query : make_queries()) {
+        const auto documents = server.FindTopDocuments(query);
+        temporary_expected.insert(temporary_expected.end(), documents.begin(), documents.end());
+    }
+    size_t temporary_position = 0;
+    for (const Document& document : ProcessQueriesJoined(executor, server, make_queries())) {
+        ASSERT(temporary_position < temporary_expected.size());
+        ASSERT_EQUAL(document.id, temporary_expected[temporary_position].id);
+        ++temporary_position;
+    }
+    ASSERT_EQUAL(temporary_position, temporary_expected.size());
+
+    // Used from a task of a busy executor, the results must neither wait for the queued tasks nor deadlock
+    QueryExecutor single_executor(1);
+    const std::vector<std::string> nested_queries = { "cat"s, "dog"s };
+    auto nested = single_executor.Submit([&server, &single_executor, &nested_queries]() {
+        const JoinedQueryResults read = ProcessQueriesJoined(single_executor, server, nested_queries);
+        const JoinedQueryResults unread = ProcessQueriesJoined(single_executor, server, nested_queries);
+        return static_cast<size_t>(std::distance(read.begin(), read.end()));
+    });
+    ASSERT(nested.wait_for(std::chrono::seconds(30)) == std::future_status::ready);
+    ASSERT_EQUAL(nested.get(), server.FindTopDocuments("cat"s).size() + server.FindTopDocuments("dog"s).size());
+
+    // The documents before an invalid query are delivered, then its exception is thrown
+    std::vector<std::string> invalid_queries = { "cat"s, "--cat"s, "dog"s };
+    const JoinedQueryResults invalid_results = ProcessQueriesJoined(executor, server, invalid_queries);
+    size_t delivered = 0;
+    bool thrown = false;
+    try {
+        for (auto it = invalid_results.begin(); it != invalid_results.end(); ++it) {
+            ++delivered;
+        }
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    ASSERT_EQUAL(delivered, server.FindTopDocuments("cat"s).size());
+}
+
+void TestQueryCache() {
+    SearchServer server("in the"s);
+    server.AddDocument(1, "funny pet cat"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(2, "cat in the city"s, DocumentStatus::ACTUAL, { 2 });
+    server.AddDocument(3, "dog in the village"s, DocumentStatus::BANNED, { 3 });
+    ASSERT_EQUAL(server.GetQueryCacheStats().misses, 0u);
+    server.FindTopDocuments("cat"s);
+    ASSERT_EQUAL(server.GetQueryCacheStats().misses, 0u);
+
+    server.SetQueryCacheCapacity(32);
+    const auto first = server.FindTopDocuments("cat -dog"s);
+    // Word order, repetitions and stop words do not change the key
+    const auto second = server.FindTopDocuments("-dog cat in cat"s);
+    ASSERT_EQUAL(server.GetQueryCacheStats().misses, 1u);
+    ASSERT_EQUAL(server.GetQueryCacheStats().hits, 1u);
+    ASSERT_EQUAL(second.size(), first.size());
+    for (size_t i = 0; i < first.size(); ++i) {
+        ASSERT_EQUAL(second[i].id, first[i].id);
+        ASSERT_EQUAL(second[i].relevance, first[i].relevance);
+    }
+    // Status, result count and policy: a different status or count is another key, the policy is not
+    server.FindTopDocuments("cat -dog"s, DocumentStatus::BANNED);
+    server.FindTopDocuments("cat -dog"s, DocumentStatus::ACTUAL, 1);
+    server.FindTopDocuments(std::execution::par, "cat -dog"s);
+    ASSERT_EQUAL(server.GetQueryCacheStats().misses, 3u);
+    ASSERT_EQUAL(server.GetQueryCacheStats().hits, 2u);
+    // Custom predicates bypass the cache
+    server.FindTopDocuments("cat"s, [](int, DocumentStatus, int) { return true; });
+    ASSERT_EQUAL(server.GetQueryCacheStats().misses, 3u);
+
+    server.AddDocument(4, "cat cat"s, DocumentStatus::ACTUAL, { 4 });
+    const auto after_add = server.FindTopDocuments("cat -dog"s);
+    ASSERT_EQUAL(server.GetQueryCacheStats().misses, 4u);
+    ASSERT_EQUAL(after_add.front().id, 4);
+    server.WaitForMerges();
+    server.FindTopDocuments("cat -dog"s);
+    ASSERT_EQUAL(server.GetQueryCacheStats().hits, 3u);
+    server.RemoveDocument(4);
+    ASSERT_EQUAL(server.FindTopDocuments("cat -dog"s).size(), first.size());
+    ASSERT_EQUAL(server.GetQueryCacheStats().misses, 5u);
+
+    for (int i = 0; i < 100; ++i) {
+        server.FindTopDocuments("cat word"s + std::to_string(i));
+    }
+    ASSERT(server.GetQueryCacheStats().size <= 32u);
+
+    // Concurrent batches agree with uncached searches
+    std::vector<std::string> queries;
+    for (int i = 0; i < 200; ++i) {
+        queries.push_back(i % 3 == 0 ? "cat"s : i % 3 == 1 ? "dog -city"s : "pet village"s);
+    }
+    const auto cached = ProcessQueries(server, queries);
+    server.SetQueryCacheCapacity(0);
+    ASSERT_EQUAL(server.GetQueryCacheStats().hits, 0u);
+    const auto uncached = ProcessQueries(server, queries);
+    ASSERT_EQUAL(cached.size(), uncached.size());
+    for (size_t i = 0; i < cached.size(); ++i) {
+        ASSERT_EQUAL(cached[i].size(), uncached[i].size());
+        for (size_t j = 0; j < cached[i].size(); ++j) {
+            ASSERT_EQUAL(cached[i][j].id, uncached[i][j].id);
+        }
+    }
+}
+
+void TestInverseDocumentFreqUpdates() {
+    SearchServer server("in the"s);
+    for (int id = 0; id < 10; ++id) {
+        server.AddDocument(id, id % 2 == 0 ? "cat dog"s : "cat"s, DocumentStatus::ACTUAL, { id });
+    }
+    const auto check_dog = [&server](size_t document_count, size_t dog_count) {
+        const auto documents = server.FindTopDocuments("dog"s);
+        ASSERT(!documents.empty());
+        const double expected = std::log(document_count * 1.0 / dog_count) * 0.5;
+        ASSERT(std::abs(documents.front().relevance - expected) < ACCURACY);
+    };
+    check_dog(10, 5);
+    // A repeated id is subtracted once
+    server.RemoveDocuments({ 0, 0, 1, 2 });
+    check_dog(7, 3);
+    server.RemoveDocument(std::execution::par, 4);
+    check_dog(6, 2);
+    server.WaitForMerges();
+    check_dog(6, 2);
+    server.AddDocument(0, "dog cat"s, DocumentStatus::ACTUAL, { 0 });
+    check_dog(7, 3);
+    // A word whose documents are all removed matches nothing
+    server.AddDocument(100, "parrot dog"s, DocumentStatus::ACTUAL, { 0 });
+    server.RemoveDocument(100);
+    ASSERT(server.FindTopDocuments("parrot"s).empty());
+    server.SetRetrievalMode(RetrievalMode::EXHAUSTIVE);
+    ASSERT(server.FindTopDocuments("parrot"s).empty());
+    check_dog(7, 3);
+
+    const std::string path = (std::filesystem::temp_directory_path() / "search_server_idf_test.index").string();
+    server.SaveIndex(path);
+    const auto opened = SearchServer::OpenIndex(path);
+    std::filesystem::remove(path);
+    const auto documents = opened->FindTopDocuments("dog"s);
+    ASSERT(std::abs(documents.front().relevance - server.FindTopDocuments("dog"s).front().relevance) < ACCURACY);
+}
+
+void TestBm25Ranking() {
+    SearchServer server("in the"s);
+    server.AddDocument(1, "cat dog"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(2, "cat dog bird fish"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(3, "cat cat cat cat cat cat cat cat bird fish"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(4, "bird in the sky"s, DocumentStatus::ACTUAL, { 1 });
+    ASSERT(server.GetRankingFunction() == RankingFunction::TF_IDF);
+    // TF-IDF prefers the document made mostly of the word
+    ASSERT_EQUAL(server.FindTopDocuments("cat"s).front().id, 3);
+
+    server.SetRankingFunction(RankingFunction::BM25);
+    const double average_length = (2 + 4 + 10 + 2) / 4.0;
+    const auto bm25 = [average_length](double document_freq, double term_count, double length) {
+        return std::log(4 / document_freq) * term_count * (BM25_K1 + 1) /
+            (term_count + BM25_K1 * (1 - BM25_B + BM25_B * length / average_length));
+    };
+    const auto documents = server.FindTopDocuments("dog fish"s);
+    ASSERT_EQUAL(documents.size(), 3u);
+    // The short document and the one with both words beat the long one
+    ASSERT_EQUAL(documents[0].id, 2);
+    ASSERT(std::abs(documents[0].relevance - (bm25(2, 1, 4) + bm25(2, 1, 4))) < ACCURACY);
+    ASSERT_EQUAL(documents[1].id, 1);
+    ASSERT(std::abs(documents[1].relevance - bm25(2, 1, 2)) < ACCURACY);
+    ASSERT_EQUAL(documents[2].id, 3);
+    ASSERT(std::abs(documents[2].relevance - bm25(2, 1, 10)) < ACCURACY);
+    // Repetitions saturate: eight occurrences score far less than eight times one
+    const auto cat = server.FindTopDocuments("cat"s);
+    ASSERT(std::abs(cat.front().relevance - bm25(3, 8, 10)) < ACCURACY);
+    ASSERT(cat.front().relevance < 3 * bm25(3, 1, 10));
+
+    // Removing a document changes the average length
+    server.RemoveDocument(3);
+    const double shorter_average = (2 + 4 + 2) / 3.0;
+    const double expected = std::log(3 / 2.0) * (BM25_K1 + 1) / (1 + BM25_K1 * (1 - BM25_B + BM25_B * 2 / shorter_average));
+    const auto dog = server.FindTopDocuments(std::execution::par, "dog"s);
+    ASSERT_EQUAL(dog.front().id, 1);
+    ASSERT(std::abs(dog.front().relevance - expected) < ACCURACY);
+}
+
+void TestDocumentFilter() {
+    std::mt19937 generator(11);
+    const std::vector<std::string> words = { "cat"s, "dog"s, "city"s, "village"s, "sky"s, "roof"s, "funny"s, "pet"s, "rat"s, "hair"s };
+    SearchServer server("and in the"s);
+    for (int id = 0; id < 2000; ++id) {
+        std::string text;
+        const int length = 1 + static_cast<int>(generator() % 8);
+        for (int i = 0; i < length; ++i) {
+            text += words[std::min(generator() % words.size(), generator() % words.size())] + " "s;
+        }
+        // BANNED documents are rare, so their postings are mostly skipped
+        const auto status = static_cast<DocumentStatus>(id % 50 == 0 ? 2 : id % 2);
+        server.AddDocument(id, text, status, { static_cast<int>(generator() % 10) });
+    }
+    server.RemoveDocuments({ 0, 100, 101 });
+    const std::vector<DocumentFilter> filters = { {}, { DocumentStatus::BANNED, std::nullopt }, { std::nullopt, 7 },
+        { DocumentStatus::ACTUAL, 5 }, { DocumentStatus::REMOVED, std::nullopt } };
+    const std::vector<std::string> queries = { "cat"s, "funny pet rat hair -sky"s, "cat dog city village sky roof funny pet rat hair"s, "-cat dog"s };
+    for (const RetrievalMode mode : { RetrievalMode::EXHAUSTIVE, RetrievalMode::MAX_SCORE }) {
+        server.SetRetrievalMode(mode);
+        for (const DocumentFilter& filter : filters) {
+            const auto lambda = [filter](int, DocumentStatus status, int rating) {
+                return (!filter.status || status == *filter.status) && (!filter.min_rating || rating >= *filter.min_rating);
+            };
+            for (const std::string& query : queries) {
+                for (const size_t max_count : { size_t(1), MAX_RESULT_DOCUMENT_COUNT, size_t(1000) }) {
+                    const auto expected = server.FindTopDocuments(query, lambda, max_count);
+                    const auto actual = server.FindTopDocuments(query, filter, max_count);
+                    const auto parallel = server.FindTopDocuments(std::execution::par, query, filter, max_count);
+                    ASSERT_EQUAL(actual.size(), expected.size());
+                    ASSERT_EQUAL(parallel.size(), expected.size());
+                    for (size_t i = 0; i < expected.size(); ++i) {
+                        ASSERT_EQUAL(actual[i].id, expected[i].id);
+                        ASSERT_EQUAL(actual[i].relevance, expected[i].relevance);
+                        ASSERT_EQUAL(parallel[i].id, expected[i].id);
+                    }
+                }
+            }
+        }
+    }
+    ASSERT(server.FindTopDocuments("cat"s, DocumentFilter{ DocumentStatus::REMOVED, std::nullopt }).empty());
+    const auto rated = server.FindTopDocuments("cat dog"s, DocumentFilter{ DocumentStatus::ACTUAL, 9 }, 1000);
+    ASSERT(!rated.empty());
+    for (const Document& document : rated) {
+        ASSERT(document.rating >= 9);
+        ASSERT_EQUAL(document.id % 2, 0);
+    }
+}
+
+void TestPhraseAndNearQueries() {
+    SearchServer server("in the a"s, SearchServerOptions{ true });
+    server.AddDocument(1, "cat in the hat"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(2, "hat cat"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(3, "cat on the big hat"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(4, "cat x hat cat in the hat dog"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(5, "black cat sat"s, DocumentStatus::ACTUAL, { 1 });
+    const auto find_ids = [&server](const std::string& query) {
+        std::vector<int> ids;
+        for (const Document& document : server.FindTopDocuments(query, DocumentStatus::ACTUAL, 100)) {
+            ids.push_back(document.id);
+        }
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    };
+    const auto check_all_modes = [&](const std::string& query, const std::vector<int>& expected) {
+        for (const RetrievalMode mode : { RetrievalMode::EXHAUSTIVE, RetrievalMode::MAX_SCORE }) {
+            server.SetRetrievalMode(mode);
+            ASSERT_EQUAL_HINT(find_ids(query), expected, query);
+        }
+    };
+    const auto check = [&]() {
+        // Stop words keep their places in phrases
+        check_all_modes("\"cat in the hat\""s, std::vector<int>{ 1, 4 });
+        check_all_modes("\"cat a a hat\""s, std::vector<int>{ 1, 4 });
+        check_all_modes("\"hat cat\""s, std::vector<int>{ 2, 4 });
+        check_all_modes("\"cat hat\""s, std::vector<int>{});
+        check_all_modes("\"black cat\" sat"s, std::vector<int>{ 5 });
+        check_all_modes("\"the cat in the hat\""s, std::vector<int>{ 1, 4 });
+        check_all_modes("\"the black cat sat\""s, std::vector<int>{ 5 });
+        check_all_modes("\"cat in the hat\" -dog"s, std::vector<int>{ 1 });
+        check_all_modes("cat NEAR/1 hat"s, std::vector<int>{ 2, 4 });
+        check_all_modes("cat NEAR/3 hat"s, std::vector<int>{ 1, 2, 4 });
+        check_all_modes("hat NEAR/4 cat"s, std::vector<int>{ 1, 2, 3, 4 });
+        check_all_modes("cat NEAR/1 hat NEAR/1 dog"s, std::vector<int>{ 4 });
+        check_all_modes("cat NEAR/1 dog"s, std::vector<int>{});
+        check_all_modes("black NEAR/1 cat NEAR/1 sat"s, std::vector<int>{ 5 });
+        check_all_modes("hat NEAR/0 hat"s, std::vector<int>{ 1, 2, 3, 4 });
+        // A phrase without two words to place is an ordinary query
+        check_all_modes("\"the sat\""s, std::vector<int>{ 5 });
+        server.SetRetrievalMode(RetrievalMode::MAX_SCORE);
+        const auto phrase = server.FindTopDocuments(std::execution::par, "\"cat in the hat\""s);
+        ASSERT_EQUAL(phrase.size(), 2u);
+        ASSERT_EQUAL(std::get<0>(server.MatchDocument("\"cat in the hat\""s, 3)), std::vector<std::string_view>{});
+        ASSERT_EQUAL(std::get<0>(server.MatchDocument(std::execution::par, "\"hat cat\""s, 2)),
+            (std::vector<std::string_view>{ "cat", "hat" }));
+        ASSERT_EQUAL(std::get<0>(server.MatchDocument("cat NEAR/1 hat"s, 4)), (std::vector<std::string_view>{ "cat", "hat" }));
+        ASSERT_EQUAL(std::get<0>(server.MatchDocument("\"the black cat\""s, 5)), (std::vector<std::string_view>{ "black", "cat" }));
+    };
+    check();
+    for (int id = 10; id < 40; ++id) {
+        server.AddDocument(id, "filler words "s + std::to_string(id), DocumentStatus::ACTUAL, { 1 });
+    }
+    server.RemoveDocument(10);
+    server.WaitForMerges();
+    check();
+
+    const std::string path = (std::filesystem::temp_directory_path() / "search_server_positions_test.index").string();
+    server.SaveIndex(path);
+    const auto opened = SearchServer::OpenIndex(path);
+    std::filesystem::remove(path);
+    ASSERT(opened->GetOptions().index_positions);
+    ASSERT_EQUAL(opened->FindTopDocuments("\"cat in the hat\""s).size(), 2u);
+    ASSERT_EQUAL(opened->FindTopDocuments("cat NEAR/1 hat"s).size(), 2u);
+
+    for (const std::string& query : { "\"cat hat"s, "cat hat\""s, "\"cat \"hat\"\""s, "\"cat -hat\""s, "NEAR/2 cat"s,
+        "cat NEAR/2"s, "cat NEAR/x hat"s, "cat NEAR/2 NEAR/2 hat"s, "cat NEAR/2 -hat"s, "cat NEAR/2 \"hat cat\""s }) {
+        bool is_rejected = false;
+        try {
+            server.FindTopDocuments(query);
+        } catch (const std::invalid_argument&) {
+            is_rejected = true;
+        }
+        ASSERT_HINT(is_rejected, query);
+    }
+    SearchServer plain("in the"s);
+    plain.AddDocument(1, "cat in the hat"s, DocumentStatus::ACTUAL, { 1 });
+    ASSERT_EQUAL(plain.FindTopDocuments("cat hat"s).size(), 1u);
+    bool is_rejected = false;
+    try {
+        plain.FindTopDocuments("\"cat in the hat\""s);
+    } catch (const std::invalid_argument&) {
+        is_rejected = true;
+    }
+    ASSERT_HINT(is_rejected, "Phrases need positions"s);
+}
+
+void TestPrefixAndFuzzyQueries() {
+    // The trie walk must find exactly the words that a full edit distance table accepts
+    std::mt19937 generator(5);
+    std::set<std::string> unique_words;
+    for (int i = 0; i < 300; ++i) {
+        std::string word;
+        const int length = 1 + static_cast<int>(generator() % 6);
+        for (int j = 0; j < length; ++j) {
+            word += static_cast<char>('a' + generator() % 3);
+        }
+        unique_words.insert(word);
+    }
+    std::vector<std::string> vocabulary(unique_words.begin(), unique_words.end());
+    std::shuffle(vocabulary.begin(), vocabulary.end(), generator);
+    const std::vector<std::string_view> words(vocabulary.begin(), vocabulary.end());
+    const TermTrie trie(words);
+    const auto edit_distance = [](std::string_view lhs, std::string_view rhs) {
+        std::vector<std::vector<uint32_t>> table(lhs.size() + 1, std::vector<uint32_t>(rhs.size() + 1));
+        for (size_t i = 0; i <= lhs.size(); ++i) {
+            for (size_t j = 0; j <= rhs.size(); ++j) {
+                table[i][j] = i == 0 || j == 0 ? static_cast<uint32_t>(i + j)
+                    : std::min({ table[i - 1][j] + 1, table[i][j - 1] + 1, table[i - 1][j - 1] + (lhs[i - 1] != rhs[j - 1]) });
+            }
+        }
+        return table[lhs.size()][rhs.size()];
+    };
+    for (const std::string& query : { "abc"s, "a"s, "cab"s, "bbbb"s, "x"s, "abcabcab"s }) {
+        for (const uint32_t max_distance : { 1u, 2u }) {
+            std::vector<std::pair<uint32_t, uint32_t>> found;
+            trie.ForEachWithinDistance(query, max_distance, [&found](uint32_t term, uint32_t distance) {
+                found.emplace_back(term, distance);
+            });
+            std::sort(found.begin(), found.end());
+            std::vector<std::pair<uint32_t, uint32_t>> expected;
+            for (uint32_t term = 0; term < words.size(); ++term) {
+                if (const uint32_t distance = edit_distance(query, words[term]); distance <= max_distance) {
+                    expected.emplace_back(term, distance);
+                }
+            }
+            ASSERT_HINT(found == expected, query);
+        }
+        std::vector<uint32_t> found;
+        trie.ForEachWithPrefix(query, [&found](uint32_t term) { found.push_back(term); });
+        std::sort(found.begin(), found.end());
+        std::vector<uint32_t> expected;
+        for (uint32_t term = 0; term < words.size(); ++term) {
+            if (words[term].substr(0, query.size()) == std::string_view(query)) {
+                expected.push_back(term);
+            }
+        }
+        ASSERT_EQUAL(found, expected);
+    }
+    for (uint32_t term = 0; term < words.size(); ++term) {
+        ASSERT_EQUAL(*trie.Find(words[term]), term);
+    }
+    ASSERT(!trie.Find("abcx"s));
+
+    SearchServer server("and in the"s);
+    server.AddDocument(1, "funny pet"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(2, "petrol station"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(3, "peter and the wolf"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(4, "curly cat"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(5, "grey cart"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(6, "funny dog"s, DocumentStatus::ACTUAL, { 1 });
+    const auto find_ids = [&server](const std::string& query) {
+        std::vector<int> ids;
+        for (const Document& document : server.FindTopDocuments(query, DocumentStatus::ACTUAL, 1000)) {
+            ids.push_back(document.id);
+        }
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    };
+    ASSERT_EQUAL(find_ids("pet*"s), (std::vector<int>{ 1, 2, 3 }));
+    ASSERT_EQUAL(find_ids("funny -pet*"s), std::vector<int>{ 6 });
+    ASSERT_EQUAL(find_ids("cat~"s), (std::vector<int>{ 4, 5 }));
+    ASSERT_EQUAL(find_ids("dig~1"s), std::vector<int>{ 6 });
+    ASSERT_EQUAL(find_ids("dig~2"s), std::vector<int>{ 6 });
+    ASSERT_EQUAL(std::get<0>(server.MatchDocument("pet* wolf~"s, 3)), (std::vector<std::string_view>{ "peter", "wolf" }));
+    ASSERT_EQUAL(std::get<0>(server.MatchDocument(std::execution::par, "pet*"s, 2)), std::vector<std::string_view>{ "petrol" });
+
+    // A word one edit away counts half
+    const auto fuzzy = server.FindTopDocuments("cat~"s);
+    ASSERT_EQUAL(fuzzy.size(), 2u);
+    ASSERT_EQUAL(fuzzy[0].id, 4);
+    ASSERT(std::abs(fuzzy[0].relevance - server.FindTopDocuments("cat"s).front().relevance) < ACCURACY);
+    ASSERT(std::abs(fuzzy[1].relevance - server.FindTopDocuments("cart"s).front().relevance / 2) < ACCURACY);
+    // The typed word keeps its full weight
+    ASSERT(std::abs(server.FindTopDocuments("cart cat~"s).front().relevance - server.FindTopDocuments("cart"s).front().relevance) < ACCURACY);
+    for (const std::string& query : { "cat~ pet* funny"s, "cart~2 -funny"s }) {
+        server.SetRetrievalMode(RetrievalMode::EXHAUSTIVE);
+        const auto expected = server.FindTopDocuments(query);
+        server.SetRetrievalMode(RetrievalMode::MAX_SCORE);
+        const auto actual = server.FindTopDocuments(std::execution::par, query);
+        ASSERT_EQUAL(actual.size(), expected.size());
+        for (size_t i = 0; i < actual.size(); ++i) {
+            ASSERT_EQUAL(actual[i].id, expected[i].id);
+            ASSERT(std::abs(actual[i].relevance - expected[i].relevance) < ACCURACY);
+        }
+    }
+
+    server.RemoveDocument(3);
+    ASSERT_EQUAL(find_ids("pet*"s), (std::vector<int>{ 1, 2 }));
+    for (int id = 100; id < 200; ++id) {
+        server.AddDocument(id, "word"s + std::to_string(id) + " common"s, DocumentStatus::ACTUAL, { 1 });
+    }
+    server.WaitForMerges();
+    ASSERT_EQUAL(find_ids("word*"s).size(), MAX_TERM_EXPANSIONS);
+    // Exclusions are not capped
+    ASSERT_EQUAL(find_ids("common -word*"s), std::vector<int>{});
+    ASSERT_EQUAL(find_ids("pet*"s), (std::vector<int>{ 1, 2 }));
+
+    for (const std::string& query : { "cat~3"s, "*"s, "~"s, "-~2"s }) {
+        bool is_rejected = false;
+        try {
+            server.FindTopDocuments(query);
+        } catch (const std::invalid_argument&) {
+            is_rejected = true;
+        }
+        ASSERT_HINT(is_rejected, query);
+    }
+}
+
+void TestMetrics() {
+    // Every latency falls into a bucket whose width is at most 1/16 of its values
+    uint64_t previous_bucket = 0;
+    for (uint64_t nanoseconds = 0; nanoseconds < 100000; nanoseconds += 1 + nanoseconds / 50) {
+        const size_t bucket = GetLatencyBucket(nanoseconds);
+        ASSERT(bucket >= previous_bucket);
+        ASSERT(GetLatencyBucketEnd(bucket) > nanoseconds);
+        ASSERT(bucket == 0 || GetLatencyBucketEnd(bucket - 1) <= nanoseconds);
+        ASSERT((GetLatencyBucketEnd(bucket) - 1 - nanoseconds) * 16 <= std::max<uint64_t>(nanoseconds, 16));
+        previous_bucket = bucket;
+    }
+    ASSERT_EQUAL(GetLatencyBucket((uint64_t{ 1 } << LATENCY_MAX_EXPONENT) - 1), LATENCY_OVERFLOW_BUCKET - 1);
+    ASSERT_EQUAL(GetLatencyBucket(uint64_t{ 1 } << 50), LATENCY_OVERFLOW_BUCKET);
+
+    LatencyHistogramSnapshot histogram;
+    ASSERT_EQUAL(histogram.GetPercentile(0.5), 0u);
+    for (uint64_t nanoseconds = 1; nanoseconds <= 1000; ++nanoseconds) {
+        ++histogram.buckets[GetLatencyBucket(nanoseconds)];
+        ++histogram.count;
+    }
+    ASSERT_EQUAL(histogram.GetPercentile(0.01), 10u);
+    const uint64_t median = histogram.GetPercentile(0.5);
+    ASSERT(median >= 500 && median <= 500 + 500 / 16);
+    ASSERT(histogram.GetPercentile(1.0) >= 1000);
+
+    SearchServer server("and in the"s);
+    server.AddDocument(1, "white cat and fashionable collar"s, DocumentStatus::ACTUAL, { 8, -3 });
+    server.AddDocument(2, "fluffy cat fluffy tail"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    server.AddDocument(3, "groomed dog expressive eyes"s, DocumentStatus::ACTUAL, { 5, -12, 2, 1 });
+    server.AddDocument(4, "groomed cat"s, DocumentStatus::BANNED, { 9 });
+    const MetricsSnapshot before = GetMetricsSnapshot();
+    ASSERT_EQUAL(server.FindTopDocuments("fluffy cat"s).size(), 2u);
+    server.MatchDocument("fluffy cat"s, 2);
+    std::thread([&server]() { server.FindTopDocuments("groomed -dog"s, DocumentStatus::BANNED); }).join();
+    const MetricsSnapshot after = GetMetricsSnapshot();
+    const auto stage_count = [&](MetricStage stage) {
+        return after.GetStage(stage).count - before.GetStage(stage).count;
+    };
+    const auto counter = [&](MetricCounter metric_counter) {
+        return after.GetCounter(metric_counter) - before.GetCounter(metric_counter);
+    };
+    if (METRICS_ENABLED) {
+        // The totals of the exited thread are kept
+        ASSERT_EQUAL(stage_count(MetricStage::QUERY), 2u);
+        ASSERT_EQUAL(stage_count(MetricStage::MATCH), 1u);
+        ASSERT_EQUAL(stage_count(MetricStage::PARSE), 3u);
+        ASSERT(stage_count(MetricStage::RETRIEVAL) >= 2);
+        ASSERT(stage_count(MetricStage::TOP_K) >= 2);
+        ASSERT(counter(MetricCounter::SEARCHED_SEGMENTS) >= 2);
+        ASSERT_EQUAL(counter(MetricCounter::SCORED_DOCUMENTS), 3u);
+        ASSERT(counter(MetricCounter::PREDICATE_CALLS) >= 3);
+        const LatencyHistogramSnapshot& query = after.GetStage(MetricStage::QUERY);
+        ASSERT(query.GetPercentile(1.0) * query.count >= query.sum_nanoseconds);
+    }
+    else {
+        ASSERT_EQUAL(stage_count(MetricStage::QUERY), 0u);
+        ASSERT_EQUAL(counter(MetricCounter::SCORED_DOCUMENTS), 0u);
+    }
+
+    const std::string text = FormatPrometheusMetrics(after);
+    const std::string query_count = std::to_string(after.GetStage(MetricStage::QUERY).count);
+    ASSERT(text.find("# TYPE search_server_stage_duration_seconds histogram\n"s) != std::string::npos);
+    ASSERT(text.find("search_server_stage_duration_seconds_bucket{stage=\"query\",le=\"+Inf\"} "s + query_count + "\n"s) != std::string::npos);
+    ASSERT(text.find("search_server_stage_duration_seconds_count{stage=\"query\"} "s + query_count + "\n"s) != std::string::npos);
+    ASSERT(text.find("search_server_stage_duration_seconds_bucket{stage=\"parse\",le=\"1.6000000000000001e-08\"} "s) != std::string::npos);
+    ASSERT(text.find("# TYPE search_server_scored_documents_total counter\n"s) != std::string::npos);
+    ASSERT(text.find("search_server_scored_documents_total "s + std::to_string(after.GetCounter(MetricCounter::SCORED_DOCUMENTS)) + "\n"s) != std::string::npos);
+
+    // A latency above the top bound counts in le="+Inf" only
+    MetricsSnapshot overflow;
+    LatencyHistogramSnapshot& overflow_query = overflow.stages[static_cast<size_t>(MetricStage::QUERY)];
+    ++overflow_query.buckets[GetLatencyBucket(uint64_t{ 1 } << (LATENCY_MAX_EXPONENT + 1))];
+    ++overflow_query.count;
+    ASSERT_EQUAL(overflow_query.GetPercentile(1.0), std::numeric_limits<uint64_t>::max());
+    const std::string overflow_text = FormatPrometheusMetrics(overflow);
+    const size_t top_bucket = overflow_text.find("search_server_stage_duration_seconds_bucket{stage=\"query\",le=\"1099.5"s);
+    ASSERT(top_bucket != std::string::npos);
+    ASSERT_EQUAL(overflow_text.substr(overflow_text.find('}', top_bucket), 4), "} 0\n"s);
+    ASSERT(overflow_text.find("search_server_stage_duration_seconds_bucket{stage=\"query\",le=\"+Inf\"} 1\n"s) != std::string::npos);
+
+    const std::string path = (std::filesystem::temp_directory_path() / "search_server_test.prom").string();
+    WritePrometheusMetrics(path, after);
+    std::ifstream input(path);
+    std::stringstream written;
+    written << input.rdbuf();
+    ASSERT_EQUAL(written.str(), text);
+    std::filesystem::remove(path);
+    try {
+        WritePrometheusMetrics((std::filesystem::temp_directory_path() / "missing_directory" / "metrics.prom").string(), after);
+        ASSERT_HINT(false, "Writing into a missing directory must throw"s);
+    }
+    catch (const std::runtime_error&) {
+    }
+}
+
+void TestThrowingPredicateKeepsResults() {
+    SearchServer server("and in the"s);
+    server.SetRetrievalMode(RetrievalMode::EXHAUSTIVE);
+    for (int id = 0; id < 20; ++id) {
+        server.AddDocument(id, id < 10 ? "cat in the city"s : "dog in the village"s, DocumentStatus::ACTUAL, { 1 });
+    }
+    // Settles the segments, so whether stale scores would land on documents does not depend on timing
+    server.WaitForMerges();
+    bool thrown = false;
+    try {
+        server.FindTopDocuments("cat"s, [](int document_id, DocumentStatus, int) {
+            if (document_id == 3) {
+                throw std::out_of_range("3"s);
+            }
+            return true;
+        });
+    } catch (const std::out_of_range&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    // The scores accumulated before the exception must not leak into the next query on this thread
+    const auto documents = server.FindTopDocuments("dog"s, DocumentStatus::ACTUAL, 50);
+    ASSERT_EQUAL(documents.size(), 10u);
+    ASSERT(std::all_of(documents.begin(), documents.end(), [](const Document& document) { return document.id >= 10; }));
+}
+
 void TestSearchServer() {
     RUN_TEST(TestExcludeStopWordsFromAddedDocumentContent);
     RUN_TEST(TestCorrectSearchedDocs);
@@ -294,5 +1453,28 @@ void TestSearchServer() {
     RUN_TEST(TestFilterTopDocsWithPredicate);
     RUN_TEST(TestFindDocsWithStatus);
     RUN_TEST(TestRelevanceTopDocs);
+    RUN_TEST(TestWordFrequencies);
+    RUN_TEST(TestUnorderedDocumentIds);
+    RUN_TEST(TestTopDocumentsCount);
+    RUN_TEST(TestMaxScoreMatchesExhaustive);
+    RUN_TEST(TestParallelMatchesSequential);
+    RUN_TEST(TestConcurrentReadsAndWrites);
+    RUN_TEST(TestBackgroundMergeKeepsResults);
+    RUN_TEST(TestSaveAndOpenIndex);
+    RUN_TEST(TestPostingListCodec);
+    RUN_TEST(TestSplitIntoWords);
+    RUN_TEST(TestRemoveDocuments);
+    RUN_TEST(TestFindDuplicates);
+    RUN_TEST(TestFindNearDuplicates);
+    RUN_TEST(TestQueryExecutor);
+    RUN_TEST(TestProcessQueriesJoinedStreaming);
+    RUN_TEST(TestQueryCache);
+    RUN_TEST(TestInverseDocumentFreqUpdates);
+    RUN_TEST(TestBm25Ranking);
+    RUN_TEST(TestDocumentFilter);
+    RUN_TEST(TestPhraseAndNearQueries);
+    RUN_TEST(TestPrefixAndFuzzyQueries);
+    RUN_TEST(TestMetrics);
+    RUN_TEST(TestThrowingPredicateKeepsResults);
     //      
 }
\ No newline at end of file
@@ -55,6 +55,29 @@ void TestComputeAverageRating();
 void TestFilterTopDocsWithPredicate();
 void TestFindDocsWithStatus();
 void TestRelevanceTopDocs();
+void TestWordFrequencies();
+void TestUnorderedDocumentIds();
+void TestTopDocumentsCount();
+void TestMaxScoreMatchesExhaustive();
+void TestParallelMatchesSequential();
+void TestConcurrentReadsAndWrites();
+void TestBackgroundMergeKeepsResults();
+void TestSaveAndOpenIndex();
+void TestPostingListCodec();
+void TestSplitIntoWords();
+void TestRemoveDocuments();
+void TestFindDuplicates();
+void TestFindNearDuplicates();
+void TestQueryExecutor();
+void TestProcessQueriesJoinedStreaming();
+void TestQueryCache();
+void TestInverseDocumentFreqUpdates();
+void TestBm25Ranking();
+void TestDocumentFilter();
+void TestPhraseAndNearQueries();
+void TestPrefixAndFuzzyQueries();
+void TestMetrics();
+void TestThrowingPredicateKeepsResults();
 //  TestSearchServer      
 void TestSearchServer();
 //   
@@ -0,0 +1,69 @@
+#pragma once
+#include "document.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Keeps the best max_count documents seen so far in a bounded heap,
+// so selecting a top of K out of n matches costs O(n log K) instead of a full sort
+class TopDocuments
+{
+public:
+    explicit TopDocuments(size_t max_count)
+        : max_count_(max_count)
+    {
+        documents_.reserve(max_count);
+    }
+
+    // Relevance within ACCURACY is considered equal and the rating decides;
+    // the id settles full ties so the result does not depend on the order of Push calls
+    static bool IsMoreRelevant(const Document &lhs, const Document &rhs)
+    {
+        if (std::abs(lhs.relevance - rhs.relevance) < ACCURACY)
+        {
+            if (lhs.rating == rhs.rating)
+            {
+                return lhs.id < rhs.id;
+            }
+            return lhs.rating > rhs.rating;
+        }
+        return lhs.relevance > rhs.relevance;
+    }
+
+    void Push(const Document &document)
+    {
+        if (documents_.size() < max_count_)
+        {
+            documents_.push_back(document);
+            std::push_heap(documents_.begin(), documents_.end(), IsMoreRelevant);
+        }
+        else if (max_count_ > 0 && IsMoreRelevant(document, documents_.front()))
+        {
+            std::pop_heap(documents_.begin(), documents_.end(), IsMoreRelevant);
+            documents_.back() = document;
+            std::push_heap(documents_.begin(), documents_.end(), IsMoreRelevant);
+        }
+    }
+
+    // Returns false only when no document with relevance up to max_relevance can get into the top anymore
+    bool CanAccept(double max_relevance) const
+    {
+        if (documents_.size() < max_count_)
+        {
+            return true;
+        }
+        return max_count_ > 0 && max_relevance > documents_.front().relevance - ACCURACY;
+    }
+
+    // Best document first
+    std::vector<Document> Extract()
+    {
+        std::sort(documents_.begin(), documents_.end(), IsMoreRelevant);
+        return std::move(documents_);
+    }
+
+private:
+    size_t max_count_;
+    // Heap ordered by IsMoreRelevant, so front() is the worst of the kept documents
+    std::vector<Document> documents_;
+};